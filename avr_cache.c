@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "avr_cache.h"
+#include "avr_parse.h"
+#include "avr_image.h"
+
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+#define TMP_STALE  (24 * 60 * 60) // seconds before a temp file left by a killed run is removed
+
+static char*	cache_dir   = NULL;
+static uint64_t cache_limit = CACHE_LIMIT;
+
+void set_cache_dir(char* dir) {
+	cache_dir = dir;
+}
+
+void set_cache_limit(uint64_t bytes) {
+	cache_limit = bytes;
+}
+
+bool cache_enabled(void) {
+	return cache_dir != NULL;
+}
+
+#ifndef _MSC_VER
+
+typedef struct CacheFile {
+
+	char	 name[32];
+	uint64_t size;
+	int64_t  mtime;
+
+} CacheFile;
+
+static uint64_t fnv(uint64_t hash, const uint8_t* data, size_t len) {
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= data[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+/* avr.txt is hashed as a file rather than through instr_table_version(),
+   so a hit does not need the decode table built. */
+static uint64_t cache_key(char* path, const uint32_t* options, size_t noptions) {
+
+	size_t	 size;
+	uint8_t* data = map_file("avr.txt", &size);
+	uint64_t hash = fnv(FNV_OFFSET, data, size);
+	unmap_file(data, size);
+
+	data = map_file(path, &size);
+	hash = fnv(hash, (const uint8_t*) &size, sizeof size);
+	hash = fnv(hash, data, size);
+	unmap_file(data, size);
+
+	return fnv(hash, (const uint8_t*) options, noptions * sizeof(uint32_t));
+}
+
+/* Another process may evict the file at any time, so anything that goes
+   wrong before its contents are mapped is a miss. */
+static bool serve(const char* file) {
+
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+
+	size_t size = (size_t) st.st_size;
+	if (size > 0) {
+		void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+		fwrite(data, 1, size, stdout);
+		munmap(data, size);
+	}
+	close(fd);
+	utime(file, NULL);
+	return true;
+}
+
+static char pending_tmp[4096];
+
+/* render() exits on bad input, which would leave its temp file behind */
+static void remove_pending(void) {
+
+	if (pending_tmp[0]) {
+		unlink(pending_tmp);
+	}
+}
+
+static int cmp_mtime(const void* a, const void* b) {
+
+	const CacheFile* x = a;
+	const CacheFile* y = b;
+	return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+/* Least recently used results go first. Another process may be removing
+   the same files, so failures are ignored. */
+static void evict(void) {
+
+	DIR* dir = opendir(cache_dir);
+	if (dir == NULL) {
+		return;
+	}
+
+	CacheFile*     files = NULL;
+	size_t	       count = 0, cap = 0;
+	uint64_t       total = 0;
+	struct dirent* ent;
+	char	       file[4096];
+
+	while ((ent = readdir(dir)) != NULL) {
+
+		size_t len = strlen(ent->d_name);
+		struct stat st;
+		if (strncmp(ent->d_name, "tmp.", 4) == 0) {
+			snprintf(file, sizeof file, "%s/%s", cache_dir, ent->d_name);
+			if (stat(file, &st) == 0 && time(NULL) - st.st_mtime > TMP_STALE) {
+				unlink(file);
+			}
+			continue;
+		}
+		if (len < 4 || len >= sizeof files->name || strcmp(ent->d_name + len - 4, ".lst") != 0) {
+			continue;
+		}
+		snprintf(file, sizeof file, "%s/%s", cache_dir, ent->d_name);
+		if (stat(file, &st) != 0) {
+			continue;
+		}
+
+		if (count == cap) {
+			cap   = cap ? cap * 2 : 64;
+			files = xrealloc(files, cap * sizeof(CacheFile));
+		}
+		strcpy(files[count].name, ent->d_name);
+		files[count].size  = st.st_size;
+		files[count].mtime = st.st_mtime;
+		total		  += st.st_size;
+		count++;
+	}
+	closedir(dir);
+
+	if (total > cache_limit) {
+		qsort(files, count, sizeof(CacheFile), cmp_mtime);
+		for (size_t i = 0; i < count && total > cache_limit; i++) {
+			snprintf(file, sizeof file, "%s/%s", cache_dir, files[i].name);
+			unlink(file);
+			total -= files[i].size;
+		}
+	}
+	free(files);
+}
+
+int cache_output(char* path, const uint32_t* options, size_t noptions, CacheRender render, void* arg) {
+
+	char file[4096], tmp[4096];
+	snprintf(file, sizeof file, "%s/%016llx.lst", cache_dir, (unsigned long long) cache_key(path, options, noptions));
+	if (serve(file)) {
+		return EXIT_SUCCESS;
+	}
+
+	snprintf(tmp, sizeof tmp, "%s/tmp.XXXXXX", cache_dir);
+	int fd = mkstemp(tmp);
+	if (fd < 0) {
+		fprintf(stderr, "ihex2avr: could not write to cache %s\n", cache_dir);
+		render(arg);
+		return EXIT_SUCCESS;
+	}
+
+	static bool guarded = false;
+	if (!guarded) {
+		atexit(remove_pending);
+		guarded = true;
+	}
+	strcpy(pending_tmp, tmp);
+
+	fflush(stdout);
+	int saved = dup(STDOUT_FILENO);
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+
+	render(arg);
+
+	bool written = fflush(stdout) == 0;
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+
+	/* Served before the rename, another process may evict it right after. */
+	serve(tmp);
+	if (!written || chmod(tmp, 0644) != 0 || rename(tmp, file) != 0) {
+		fprintf(stderr, "ihex2avr: could not write to cache %s\n", cache_dir);
+		unlink(tmp);
+		pending_tmp[0] = 0;
+		return EXIT_FAILURE;
+	}
+	pending_tmp[0] = 0;
+	evict();
+	return EXIT_SUCCESS;
+}
+
+#else
+
+int cache_output(char* path, const uint32_t* options, size_t noptions, CacheRender render, void* arg) {
+
+	(void) path;
+	(void) options;
+	(void) noptions;
+	render(arg);
+	return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Results directory shared between processes: "<key>.lst" holds the
+   stdout of a run, key being a hash of the input bytes, avr.txt and the
+   options that change the output. Files appear by rename so readers never
+   see them partly written, a hit refreshes the modification time and the
+   oldest files are removed once the directory is over its size limit. */
+
+#define CACHE_LIMIT (256ull << 20)
+
+typedef void (*CacheRender)(void* arg);
+
+void set_cache_dir(char* dir);
+void set_cache_limit(uint64_t bytes);
+bool cache_enabled(void);
+
+/* Writes the cached result for path and options to stdout, running
+   render with stdout redirected into the cache on a miss. */
+int cache_output(char* path, const uint32_t* options, size_t noptions, CacheRender render, void* arg);
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avr_colread.h"
+
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static int in_file(uint64_t offset, uint64_t bytes, size_t size) {
+	return offset <= size && bytes <= size - offset;
+}
+
+static int aligned(uint64_t offset) {
+	return offset % 4 == 0;
+}
+
+/* The whole file, mapped where mmap is available and read into memory
+   otherwise; NULL if it cannot be read. */
+static void* load_file(const char* path, size_t* size) {
+
+#ifndef _MSC_VER
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(ColumnHeader)) {
+		close(fd);
+		return NULL;
+	}
+
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	*size = st.st_size;
+	return map == MAP_FAILED ? NULL : map;
+#else
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL) {
+		return NULL;
+	}
+
+	void* data = NULL;
+	long  len  = fseek(fp, 0, SEEK_END) == 0 ? ftell(fp) : -1;
+	if (len >= (long) sizeof(ColumnHeader) && fseek(fp, 0, SEEK_SET) == 0 && (data = malloc(len)) != NULL &&
+	    fread(data, 1, len, fp) != (size_t) len) {
+		free(data);
+		data = NULL;
+	}
+	fclose(fp);
+	*size = len;
+	return data;
+#endif
+}
+
+static void release_file(void* data, size_t size) {
+
+#ifndef _MSC_VER
+	munmap(data, size);
+#else
+	(void) size;
+	free(data);
+#endif
+}
+
+/* Every string offset is inside the table and ends at a NUL there. */
+static int valid_strings(const uint32_t* offsets, uint32_t nstrings, const char* strings, size_t len) {
+
+	for (uint32_t i = 0; i < nstrings; i++) {
+		if (offsets[i] >= len || memchr(strings + offsets[i], '\0', len - offsets[i]) == NULL) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Maps path and points the columns into it. Returns 0, or -1 if the file
+   cannot be mapped or is not a complete export. */
+int columns_open(const char* path, AVR_Columns* cols) {
+
+	memset(cols, 0, sizeof *cols);
+
+	size_t size;
+	void*  map = load_file(path, &size);
+	if (map == NULL) {
+		return -1;
+	}
+
+	const ColumnHeader* h	 = map;
+	const uint8_t*	    base = map;
+	uint64_t	    n	 = h->count;
+	uint64_t	    table = h->strings + h->nstrings * 4ull;
+
+	if (memcmp(h->magic, COLUMNS_MAGIC, sizeof h->magic) || h->size != size ||
+	    !aligned(h->addr) || !aligned(h->operand0) || !aligned(h->operand1) || !aligned(h->strings) ||
+	    !in_file(h->addr, n * 4, size) || !in_file(h->operand0, n * 4, size) || !in_file(h->operand1, n * 4, size) ||
+	    !in_file(h->index, n, size) || !in_file(h->len, n, size) || !in_file(h->strings, h->nstrings * 4ull, size) ||
+	    !valid_strings((const uint32_t*) (base + h->strings), h->nstrings, (const char*) base + table, size - table)) {
+		release_file(map, size);
+		return -1;
+	}
+
+	cols->header	     = h;
+	cols->count	     = n;
+	cols->addr	     = (const uint32_t*) (base + h->addr);
+	cols->operand0	     = (const int32_t*) (base + h->operand0);
+	cols->operand1	     = (const int32_t*) (base + h->operand1);
+	cols->index	     = base + h->index;
+	cols->len	     = base + h->len;
+	cols->string_offsets = (const uint32_t*) (base + h->strings);
+	cols->strings	     = (const char*) (base + table);
+	cols->map	     = map;
+	cols->map_size	     = size;
+	return 0;
+}
+
+void columns_close(AVR_Columns* cols) {
+
+	if (cols->map != NULL) {
+		release_file(cols->map, cols->map_size);
+	}
+	memset(cols, 0, sizeof *cols);
+}
+
+const char* columns_mnemonic(const AVR_Columns* cols, size_t row) {
+
+	uint8_t index = cols->index[row];
+	if (index == COLUMNS_DATA || index >= cols->header->nstrings) {
+		return cols->len[row] == 1 ? ".db" : ".dw";
+	}
+	return cols->strings + cols->string_offsets[index];
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/* Columnar export of a decoded listing, read back by mapping the file:
+   a header, then one array per field and the mnemonic string table, each
+   at the offset the header gives and aligned for its element type. Rows
+   are in address order; integers are in host byte order, as in the .idx
+   file. Only libc is needed, so avr_colread.c can be built into other
+   tools on its own. */
+
+#define COLUMNS_MAGIC "AVRCOL1"
+#define COLUMNS_DATA  0xff // index of data words, operand0 holds the word
+
+typedef struct ColumnHeader {
+
+	char	 magic[8];
+	uint64_t size;	   // file size
+	uint32_t count;	   // rows
+	uint32_t nstrings; // instruction table entries named in the string table
+
+	uint64_t addr;	   // uint32_t byte address
+	uint64_t operand0; // int32_t operands as printed in the listing, 0 if absent
+	uint64_t operand1;
+	uint64_t index;	   // uint8_t instruction table entry or COLUMNS_DATA
+	uint64_t len;	   // uint8_t length in bytes
+	uint64_t strings;  // uint32_t offset per entry, then NUL-terminated mnemonics
+
+} ColumnHeader;
+
+typedef struct AVR_Columns {
+
+	const ColumnHeader* header;
+	size_t		    count;
+	const uint32_t*	    addr;
+	const int32_t*	    operand0;
+	const int32_t*	    operand1;
+	const uint8_t*	    index;
+	const uint8_t*	    len;
+	const uint32_t*	    string_offsets;
+	const char*	    strings;
+
+	void*		    map;
+	size_t		    map_size;
+
+} AVR_Columns;
+
+int	    columns_open(const char* path, AVR_Columns* cols);
+void	    columns_close(AVR_Columns* cols);
+const char* columns_mnemonic(const AVR_Columns* cols, size_t row);
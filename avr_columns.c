@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avr_columns.h"
+#include "avr_parse.h"
+#include "avr_decode.h"
+
+#define ALIGN(x, a) (((x) + (a) - 1) / (a) * (a))
+
+/* The file is laid out and filled in one buffer, then written at once. */
+int columns_export(char* path, int format, char* out_path) {
+
+	AVR_Image   img;
+	AVR_Program prog;
+
+	load_avr_instructions();
+	image_init(&img);
+	load_image(path, format, &img);
+	decode_image(&img, &prog);
+
+	size_t chars = 0;
+	for (int i = 0; i < INSTRUCTIONS; i++) {
+		chars += strlen(AVR_INSTRUCTION_SET[i].mnemonic) + 1;
+	}
+
+	ColumnHeader h;
+	uint64_t     n = prog.count;
+	memset(&h, 0, sizeof h);
+	memcpy(h.magic, COLUMNS_MAGIC, sizeof h.magic);
+	h.count	   = (uint32_t) n;
+	h.nstrings = INSTRUCTIONS;
+	h.addr	   = ALIGN(sizeof h, 8);
+	h.operand0 = h.addr + n * 4;
+	h.operand1 = h.operand0 + n * 4;
+	h.index	   = h.operand1 + n * 4;
+	h.len	   = h.index + n;
+	h.strings  = ALIGN(h.len + n, 4);
+	h.size	   = h.strings + INSTRUCTIONS * 4 + chars;
+
+	uint8_t*  buf	   = xcalloc(h.size, 1);
+	uint32_t* addr	   = (uint32_t*) (buf + h.addr);
+	int32_t*  operand0 = (int32_t*) (buf + h.operand0);
+	int32_t*  operand1 = (int32_t*) (buf + h.operand1);
+	uint8_t*  index	   = buf + h.index;
+	uint8_t*  len	   = buf + h.len;
+
+	memcpy(buf, &h, sizeof h);
+	for (size_t i = 0; i < prog.count; i++) {
+
+		const AVR_Decoded* d = &prog.instrs[i];
+
+		addr[i]	 = d->addr;
+		index[i] = d->index;
+		len[i]	 = d->len;
+		if (d->index == INSTR_NONE) {
+			operand0[i] = (int32_t) d->opcode;
+			continue;
+		}
+		int argc    = AVR_INSTRUCTION_SET[d->index].argc;
+		operand0[i] = argc > 0 ? decoded_operand(d, 0) : 0;
+		operand1[i] = argc > 1 ? decoded_operand(d, 1) : 0;
+	}
+
+	uint32_t* offsets = (uint32_t*) (buf + h.strings);
+	char*	  strings = (char*) (offsets + INSTRUCTIONS);
+	uint32_t  at	  = 0;
+	for (int i = 0; i < INSTRUCTIONS; i++) {
+		offsets[i] = at;
+		strcpy(strings + at, AVR_INSTRUCTION_SET[i].mnemonic);
+		at += (uint32_t) strlen(AVR_INSTRUCTION_SET[i].mnemonic) + 1;
+	}
+
+	int   status = EXIT_SUCCESS;
+	FILE* fp     = fopen(out_path, "wb");
+	if (fp == NULL || fwrite(buf, 1, h.size, fp) != h.size) {
+		fprintf(stderr, "ihex2avr: could not write %s\n", out_path);
+		status = EXIT_FAILURE;
+	}
+	if (fp != NULL && fclose(fp) != 0) {
+		fprintf(stderr, "ihex2avr: could not write %s\n", out_path);
+		status = EXIT_FAILURE;
+	}
+
+	free(buf);
+	free_program(&prog);
+	image_free(&img);
+	return status;
+}
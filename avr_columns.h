@@ -0,0 +1,4 @@
+#pragma once
+#include "avr_colread.h"
+
+int columns_export(char* path, int format, char* out_path);
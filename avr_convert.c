@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avr_convert.h"
+#include "avr_parse.h"
+
+#define OUT_BUF	   (1 << 20)
+#define RECORD_MAX 250 // data bytes; an S3 record also holds 4 address bytes and the checksum
+
+/* Records are built in one output buffer from a byte-to-digits table,
+   and checksums are summed while the bytes are emitted. */
+
+static char   out[OUT_BUF];
+static size_t out_len;
+static char   DIGITS[256][2];
+
+static void init_digits(void) {
+
+	static const char hex[] = "0123456789ABCDEF";
+	for (int i = 0; i < 256; i++) {
+		DIGITS[i][0] = hex[i >> 4];
+		DIGITS[i][1] = hex[i & 0xf];
+	}
+}
+
+static void flush(void) {
+
+	if (fwrite(out, 1, out_len, stdout) != out_len) {
+		fprintf(stderr, "ihex2avr: write failed\n");
+		exit(EXIT_FAILURE);
+	}
+	out_len = 0;
+}
+
+static inline void put_byte(uint8_t byte, uint8_t* sum) {
+
+	memcpy(out + out_len, DIGITS[byte], 2);
+	out_len += 2;
+	*sum	+= byte;
+}
+
+/* mark, then count, then addr_len address bytes in SREC order; Intel HEX
+   puts the type after the address instead. */
+static void put_record(char mark, char type, uint8_t rec_type, int addr_len, uint32_t addr, const uint8_t* data, int len) {
+
+	uint8_t sum = 0;
+
+	if (out_len > OUT_BUF - (2 * RECORD_MAX + 32)) {
+		flush();
+	}
+
+	out[out_len++] = mark;
+	if (mark == 'S') {
+		out[out_len++] = type;
+		put_byte((uint8_t) (len + addr_len + 1), &sum);
+	}
+	else {
+		put_byte((uint8_t) len, &sum);
+	}
+	for (int i = addr_len - 1; i >= 0; i--) {
+		put_byte((addr >> (i * 8)) & 0xff, &sum);
+	}
+	if (mark == ':') {
+		put_byte(rec_type, &sum);
+	}
+	for (int i = 0; i < len; i++) {
+		put_byte(data[i], &sum);
+	}
+
+	uint8_t check = mark == ':' ? (uint8_t) -sum : (uint8_t) ~sum;
+	memcpy(out + out_len, DIGITS[check], 2);
+	out_len += 2;
+	out[out_len++] = '\n';
+}
+
+static void write_ihex(const AVR_Image* img, int record_len) {
+
+	uint32_t upper = 0;
+
+	for (int s = 0; s < img->count; s++) {
+
+		const AVR_Segment* seg = &img->segs[s];
+
+		for (uint32_t off = 0; off < seg->len;) {
+
+			uint32_t addr = seg->addr + off;
+			uint32_t len  = seg->len - off < (uint32_t) record_len ? seg->len - off : (uint32_t) record_len;
+			if ((addr & 0xffff) + len > 0x10000) { // records do not wrap within a 64 KB page
+				len = 0x10000 - (addr & 0xffff);
+			}
+			if (addr >> 16 != upper) {
+				uint8_t ela[2] = { (uint8_t) (addr >> 24), (uint8_t) (addr >> 16) };
+				upper = addr >> 16;
+				put_record(':', 0, 4, 2, 0, ela, 2);
+			}
+			put_record(':', 0, 0, 2, addr & 0xffff, seg->data + off, (int) len);
+			off += len;
+		}
+	}
+	put_record(':', 0, 1, 2, 0, NULL, 0);
+}
+
+static void write_srec(const AVR_Image* img, int record_len) {
+
+	uint32_t end	  = img->count ? img->segs[img->count - 1].addr + img->segs[img->count - 1].len : 0;
+	int	 addr_len = end <= 0x10000 ? 2 : end <= 0x1000000 ? 3 : 4;
+
+	put_record('S', '0', 0, 2, 0, NULL, 0);
+	for (int s = 0; s < img->count; s++) {
+		const AVR_Segment* seg = &img->segs[s];
+		for (uint32_t off = 0; off < seg->len; off += record_len) {
+			uint32_t len = seg->len - off < (uint32_t) record_len ? seg->len - off : (uint32_t) record_len;
+			put_record('S', '0' + addr_len - 1, 0, addr_len, seg->addr + off, seg->data + off, (int) len);
+		}
+	}
+	put_record('S', '0' + 11 - addr_len, 0, addr_len, 0, NULL, 0); // S9, S8 or S7
+}
+
+/* From the lowest address to the highest, gaps filled. */
+static void write_bin(const AVR_Image* img, uint8_t fill) {
+
+	uint32_t addr = img->count ? img->segs[0].addr : 0;
+
+	for (int s = 0; s < img->count; s++) {
+
+		const AVR_Segment* seg = &img->segs[s];
+
+		for (; addr < seg->addr; addr++) {
+			if (out_len == OUT_BUF) flush();
+			out[out_len++] = (char) fill;
+		}
+		flush();
+		if (fwrite(seg->data, 1, seg->len, stdout) != seg->len) {
+			fprintf(stderr, "ihex2avr: write failed\n");
+			exit(EXIT_FAILURE);
+		}
+		addr = seg->addr + seg->len;
+	}
+}
+
+/* img to stdout in opts->format. */
+void write_image(const AVR_Image* img, const ConvertOptions* opts) {
+
+	int record_len = opts->record_len < 1 ? 1 : opts->record_len > RECORD_MAX ? RECORD_MAX : opts->record_len;
+
+	init_digits();
+	switch (opts->format) {
+		case FORMAT_IHEX: write_ihex(img, record_len); break;
+		case FORMAT_SREC: write_srec(img, record_len); break;
+		default:	  write_bin(img, opts->fill);  break;
+	}
+	flush();
+	if (fflush(stdout) != 0) {
+		fprintf(stderr, "ihex2avr: write failed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+int convert_image(char* path, int format, const ConvertOptions* opts) {
+
+	AVR_Image img;
+	image_init(&img);
+	load_image(path, format, &img);
+	write_image(&img, opts);
+	image_free(&img);
+	return EXIT_SUCCESS;
+}
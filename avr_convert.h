@@ -0,0 +1,14 @@
+#pragma once
+#include <stdint.h>
+#include "avr_image.h"
+
+typedef struct ConvertOptions {
+
+	int	format;	    // FORMAT_IHEX, FORMAT_SREC or FORMAT_BIN
+	int	record_len; // data bytes per hex record
+	uint8_t fill;	    // gaps in binary output
+
+} ConvertOptions;
+
+void write_image(const AVR_Image* img, const ConvertOptions* opts);
+int  convert_image(char* path, int format, const ConvertOptions* opts);
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avr_count.h"
+#include "avr_parse.h"
+#include "avr_instr.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/* Per thread, merged once every image is counted. Operand types and
+   lengths follow from the table entry, so decoding only bumps by_index;
+   INSTR_NONE collects the data words. */
+typedef struct Counts {
+
+	size_t by_index[INSTR_NONE + 1];
+	size_t odd_bytes; // last byte of odd-length segments
+	size_t bytes;
+
+} Counts;
+
+typedef struct Mnemonic {
+
+	const char* name;
+	size_t	    count;
+
+} Mnemonic;
+
+static void count_segment(const AVR_Segment* seg, Counts* c) {
+
+	const uint8_t* data = seg->data;
+	uint32_t       i    = 0;
+
+	while (i + 1 < seg->len) {
+
+		uint8_t index = AVR_DECODE_TABLE[data[i] | (data[i + 1] << 8)];
+		if (index != INSTR_NONE && AVR_INSTRUCTION_SET[index].len == 32) {
+			if (i + 3 < seg->len) {
+				c->by_index[index]++;
+				i += 4;
+				continue;
+			}
+			index = INSTR_NONE;
+		}
+		c->by_index[index]++;
+		i += 2;
+	}
+	c->odd_bytes += i + 1 == seg->len;
+	c->bytes     += seg->len;
+}
+
+static void count_image(char* path, int format, Counts* c) {
+
+	AVR_Image img;
+	image_init(&img);
+	load_image(path, format, &img);
+	for (int s = 0; s < img.count; s++) {
+		count_segment(&img.segs[s], c);
+	}
+	image_free(&img);
+}
+
+#ifndef _WIN32
+typedef struct Workers {
+
+	char**		paths;
+	int		format;
+	int		count;
+	int		next;
+	pthread_mutex_t lock;
+
+} Workers;
+
+typedef struct Worker {
+
+	Workers* workers;
+	Counts	 counts;
+
+} Worker;
+
+static void* count_worker(void* arg) {
+
+	Worker*	 worker	 = arg;
+	Workers* workers = worker->workers;
+	for (;;) {
+
+		pthread_mutex_lock(&workers->lock);
+		int j = workers->next++;
+		pthread_mutex_unlock(&workers->lock);
+
+		if (j >= workers->count) {
+			return NULL;
+		}
+		count_image(workers->paths[j], workers->format, &worker->counts);
+	}
+}
+#endif
+
+static int cmp_count(const void* a, const void* b) {
+
+	const Mnemonic* x = a;
+	const Mnemonic* y = b;
+	if (x->count != y->count) {
+		return (x->count < y->count) - (x->count > y->count);
+	}
+	return strcmp(x->name, y->name);
+}
+
+static void print_counts(const Counts* c, int files) {
+
+	size_t lengths[2] = { 0, 0 };
+	size_t operands[128];
+	memset(operands, 0, sizeof operands);
+
+	/* Table entries sharing a mnemonic (LD X/Y/Z, ...) are reported together. */
+	Mnemonic mnemonics[INSTRUCTIONS];
+	int	 nmnemonics = 0;
+
+	for (int i = 0; i < INSTRUCTIONS; i++) {
+
+		const AVR_Instr* instr = &AVR_INSTRUCTION_SET[i];
+		size_t		 n     = c->by_index[i];
+		if (n == 0) {
+			continue;
+		}
+
+		lengths[instr->len == 32] += n;
+		for (int k = 0; k < instr->argc; k++) {
+			operands[instr->operand_types[k] & 0x7f] += n;
+		}
+
+		int m = 0;
+		while (m < nmnemonics && strcmp(mnemonics[m].name, instr->mnemonic) != 0) m++;
+		if (m == nmnemonics) {
+			mnemonics[nmnemonics++] = (Mnemonic) { instr->mnemonic, 0 };
+		}
+		mnemonics[m].count += n;
+	}
+	qsort(mnemonics, nmnemonics, sizeof(Mnemonic), cmp_count);
+
+	size_t instrs	  = lengths[0] + lengths[1];
+	size_t code_bytes = lengths[0] * 2 + lengths[1] * 4;
+	size_t data_words = c->by_index[INSTR_NONE];
+
+	printf("files          %d\n", files);
+	printf("bytes          %zu\n", c->bytes);
+	printf("code bytes     %zu\n", code_bytes);
+	printf("data bytes     %zu\n", data_words * 2 + c->odd_bytes);
+	printf("\ninstructions   %zu\n", instrs);
+	printf("16-bit         %zu\n", lengths[0]);
+	printf("32-bit         %zu\n", lengths[1]);
+	printf("data words     %zu\n", data_words);
+	printf("odd bytes      %zu\n", c->odd_bytes);
+
+	printf("\nmnemonic          count      %%\n");
+	for (int m = 0; m < nmnemonics; m++) {
+		printf("%-10s %12zu %6.2f\n", mnemonics[m].name, mnemonics[m].count, 100.0 * mnemonics[m].count / instrs);
+	}
+
+	printf("\noperand           count\n");
+	for (int t = 1; t < 128; t++) {
+		if (operands[t] > 0) {
+			printf("%-10c %12zu\n", t, operands[t]);
+		}
+	}
+}
+
+int count_images(char* paths[], int count, int format) {
+
+	load_avr_instructions();
+
+	Counts* total = xcalloc(1, sizeof(Counts));
+
+#ifndef _WIN32
+	long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1) nthreads = 1;
+	if (nthreads > count) nthreads = count;
+
+	Workers workers;
+	workers.paths  = paths;
+	workers.format = format;
+	workers.count  = count;
+	workers.next   = 0;
+	pthread_mutex_init(&workers.lock, NULL);
+
+	Worker*	   pool	   = xcalloc(nthreads, sizeof(Worker));
+	pthread_t* threads = xcalloc(nthreads, sizeof(pthread_t));
+	for (long t = 0; t < nthreads; t++) {
+		pool[t].workers = &workers;
+		pthread_create(&threads[t], NULL, count_worker, &pool[t]);
+	}
+	for (long t = 0; t < nthreads; t++) {
+		pthread_join(threads[t], NULL);
+
+		for (int i = 0; i <= INSTR_NONE; i++) {
+			total->by_index[i] += pool[t].counts.by_index[i];
+		}
+		total->odd_bytes += pool[t].counts.odd_bytes;
+		total->bytes	 += pool[t].counts.bytes;
+	}
+	pthread_mutex_destroy(&workers.lock);
+	free(threads);
+	free(pool);
+#else
+	for (int j = 0; j < count; j++) {
+		count_image(paths[j], format, total);
+	}
+#endif
+
+	print_counts(total, count);
+	free(total);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+/* Instruction statistics over any number of images, decoded without
+   formatting: counts per mnemonic and per operand type, 16/32-bit
+   instruction counts and words that decode to no instruction. */
+int count_images(char* paths[], int count, int format);
@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "avr_daemon.h"
+#include "avr_instr.h"
+#include "avr_image.h"
+
+#ifndef _MSC_VER
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define REQUEST_MAX (64 * 1024) // working directory and arguments
+
+typedef struct RequestHeader {
+
+	uint32_t argc;
+	uint32_t len;
+
+} RequestHeader;
+
+static bool socket_address(const char* path, struct sockaddr_un* addr) {
+
+	memset(addr, 0, sizeof *addr);
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof addr->sun_path) {
+		fprintf(stderr, "ihex2avr: socket path too long: %s\n", path);
+		return false;
+	}
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+static bool read_full(int fd, void* buf, size_t len) {
+
+	for (size_t done = 0; done < len;) {
+		ssize_t n = read(fd, (char*) buf + done, len - done);
+		if (n <= 0) {
+			return false;
+		}
+		done += n;
+	}
+	return true;
+}
+
+static bool write_full(int fd, const void* buf, size_t len) {
+
+	for (size_t done = 0; done < len;) {
+		ssize_t n = write(fd, (const char*) buf + done, len - done);
+		if (n <= 0) {
+			return false;
+		}
+		done += n;
+	}
+	return true;
+}
+
+/* Header and the three descriptors in one message, then the payload. */
+static bool receive_request(int conn, RequestHeader* header, int fds[3], char* payload) {
+
+	char	      control[CMSG_SPACE(3 * sizeof(int))];
+	struct iovec  iov = { header, sizeof *header };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov	   = &iov;
+	msg.msg_iovlen	   = 1;
+	msg.msg_control	   = control;
+	msg.msg_controllen = sizeof control;
+
+	if (recvmsg(conn, &msg, MSG_WAITALL) != sizeof *header) {
+		return false;
+	}
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+		return false;
+	}
+	memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+
+	if (header->len == 0 || header->len > REQUEST_MAX || !read_full(conn, payload, header->len) || payload[header->len - 1] != '\0') {
+		for (int i = 0; i < 3; i++) close(fds[i]);
+		return false;
+	}
+
+	/* Every argument is a string of the payload after the directory. */
+	uint32_t strings = 0;
+	for (uint32_t i = 0; i < header->len; i++) {
+		strings += payload[i] == '\0';
+	}
+	if (header->argc > strings - 1) {
+		for (int i = 0; i < 3; i++) close(fds[i]);
+		return false;
+	}
+	return true;
+}
+
+/* Runs in a fork of the worker, exits with the command's status. */
+static void run_request(const RequestHeader* header, const int fds[3], char* payload, DaemonCommand command) {
+
+	char** argv = xcalloc(header->argc + 2, sizeof(char*));
+	char*  p    = payload + strlen(payload) + 1;
+	char*  end  = payload + header->len;
+	int    argc = 0;
+
+	argv[argc++] = "ihex2avr";
+	while (p < end && argc < (int) header->argc + 1) {
+		argv[argc++] = p;
+		p	    += strlen(p) + 1;
+	}
+	argv[argc] = NULL;
+
+	for (int i = 0; i < 3; i++) {
+		dup2(fds[i], i);
+		close(fds[i]);
+	}
+	if (chdir(payload) != 0) {
+		fprintf(stderr, "ihex2avr: daemon cannot enter %s\n", payload);
+		exit(EXIT_FAILURE);
+	}
+	exit(command(argc, argv));
+}
+
+static void worker(int listener, DaemonCommand command) {
+
+	char* payload = xcalloc(REQUEST_MAX, 1);
+
+	for (;;) {
+
+		int conn = accept(listener, NULL, NULL);
+		if (conn < 0) {
+			continue;
+		}
+
+		RequestHeader header;
+		int	      fds[3];
+		if (receive_request(conn, &header, fds, payload)) {
+
+			pid_t pid = fork();
+			if (pid == 0) {
+				close(conn);
+				close(listener);
+				run_request(&header, fds, payload, command);
+			}
+			for (int i = 0; i < 3; i++) close(fds[i]);
+
+			int status = 0;
+			if (pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status)) {
+				uint8_t code = (uint8_t) WEXITSTATUS(status);
+				write_full(conn, &code, 1);
+			}
+		}
+		close(conn);
+	}
+}
+
+int run_daemon(char* socket_path, int workers, DaemonCommand command) {
+
+	struct sockaddr_un addr;
+	if (!socket_address(socket_path, &addr)) {
+		return EXIT_FAILURE;
+	}
+
+	load_avr_instructions();
+
+	/* Only a socket left by an earlier daemon is replaced. */
+	struct stat st;
+	if (lstat(socket_path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, "ihex2avr: %s exists and is not a socket\n", socket_path);
+			return EXIT_FAILURE;
+		}
+		unlink(socket_path);
+	}
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, (struct sockaddr*) &addr, sizeof addr) != 0 || listen(listener, 64) != 0) {
+		fprintf(stderr, "ihex2avr: could not listen on %s\n", socket_path);
+		return EXIT_FAILURE;
+	}
+	if (workers < 1) {
+		long n	= sysconf(_SC_NPROCESSORS_ONLN);
+		workers = n > 0 ? (int) n : 1;
+	}
+	fflush(stdout);
+
+	/* Workers are replaced if one dies. */
+	for (int running = 0;;) {
+		while (running < workers) {
+			pid_t pid = fork();
+			if (pid == 0) {
+				worker(listener, command);
+			}
+			if (pid < 0) {
+				fprintf(stderr, "ihex2avr: could not start a worker\n");
+				return EXIT_FAILURE;
+			}
+			running++;
+		}
+		if (wait(NULL) > 0) {
+			running--;
+		}
+	}
+}
+
+int run_client(char* socket_path, int argc, char* argv[]) {
+
+	struct sockaddr_un addr;
+	if (!socket_address(socket_path, &addr)) {
+		return EXIT_FAILURE;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof addr) != 0) {
+		fprintf(stderr, "ihex2avr: could not connect to %s\n", socket_path);
+		return EXIT_FAILURE;
+	}
+
+	char* payload = xcalloc(REQUEST_MAX, 1);
+	if (getcwd(payload, REQUEST_MAX) == NULL) {
+		fprintf(stderr, "ihex2avr: could not get the working directory\n");
+		return EXIT_FAILURE;
+	}
+	size_t len = strlen(payload) + 1;
+	for (int i = 0; i < argc; i++) {
+		size_t n = strlen(argv[i]) + 1;
+		if (len + n > REQUEST_MAX) {
+			fprintf(stderr, "ihex2avr: command line too long for the daemon\n");
+			return EXIT_FAILURE;
+		}
+		memcpy(payload + len, argv[i], n);
+		len += n;
+	}
+
+	RequestHeader header = { (uint32_t) argc, (uint32_t) len };
+	int	      fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	char	      control[CMSG_SPACE(sizeof fds)];
+	struct iovec  iov = { &header, sizeof header };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof msg);
+	memset(control, 0, sizeof control);
+	msg.msg_iov	   = &iov;
+	msg.msg_iovlen	   = 1;
+	msg.msg_control	   = control;
+	msg.msg_controllen = sizeof control;
+
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level     = SOL_SOCKET;
+	cmsg->cmsg_type	     = SCM_RIGHTS;
+	cmsg->cmsg_len	     = CMSG_LEN(sizeof fds);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof fds);
+
+	fflush(stdout);
+	if (sendmsg(fd, &msg, 0) != sizeof header || !write_full(fd, payload, len)) {
+		fprintf(stderr, "ihex2avr: could not send the request to %s\n", socket_path);
+		return EXIT_FAILURE;
+	}
+
+	uint8_t status;
+	if (!read_full(fd, &status, 1)) {
+		fprintf(stderr, "ihex2avr: daemon closed the connection\n");
+		return EXIT_FAILURE;
+	}
+	close(fd);
+	free(payload);
+	return status;
+}
+
+#else
+
+int run_daemon(char* socket_path, int workers, DaemonCommand command) {
+
+	(void) socket_path;
+	(void) workers;
+	(void) command;
+	fprintf(stderr, "ihex2avr: daemon needs Unix domain sockets\n");
+	return EXIT_FAILURE;
+}
+
+int run_client(char* socket_path, int argc, char* argv[]) {
+
+	(void) socket_path;
+	(void) argc;
+	(void) argv;
+	fprintf(stderr, "ihex2avr: client needs Unix domain sockets\n");
+	return EXIT_FAILURE;
+}
+
+#endif
@@ -0,0 +1,13 @@
+#pragma once
+
+/* A request is the client's working directory and command line, with its
+   stdin, stdout and stderr passed along as SCM_RIGHTS. Workers each
+   accept on the listening socket and run the command in a fork of
+   themselves, so it writes straight to the client's descriptors, shares
+   the instruction table loaded once at start and can exit on bad input
+   without taking the worker down. The reply is the exit status byte. */
+
+typedef int (*DaemonCommand)(int argc, char* argv[]);
+
+int run_daemon(char* socket_path, int workers, DaemonCommand command);
+int run_client(char* socket_path, int argc, char* argv[]);
@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include "avr_data.h"
+#include "avr_parse.h"
+
+typedef struct Regions {
+
+	DataRegion* list;
+	size_t	    count;
+	size_t	    cap;
+
+} Regions;
+
+/* Printable ASCII plus the usual whitespace escapes, so the scan is one
+   table lookup per byte. */
+static uint8_t TEXT[256];
+
+static void init_text(void) {
+
+	for (int c = 0x20; c < 0x7f; c++) {
+		TEXT[c] = 1;
+	}
+	TEXT['\t'] = TEXT['\n'] = TEXT['\r'] = 1;
+}
+
+static void add_region(Regions* r, uint32_t addr, uint32_t len, int kind) {
+
+	if (r->count == r->cap) {
+		r->cap	= r->cap ? r->cap * 2 : 64;
+		r->list = xrealloc(r->list, r->cap * sizeof(DataRegion));
+	}
+	r->list[r->count].addr	  = addr;
+	r->list[r->count].len	  = len;
+	r->list[r->count++].kind = kind;
+}
+
+/* Length of the string at p including its NUL, 0 if there is none with
+   at least min characters before the end. */
+static size_t string_at(const uint8_t* p, size_t n, size_t min) {
+
+	size_t k = 0;
+	while (k < n && TEXT[p[k]]) {
+		k++;
+	}
+	return k >= min && k < n && p[k] == 0 ? k + 1 : 0;
+}
+
+/* Strings in data[pos, stop) of a gap between code. */
+static void scan_strings(Regions* r, const AVR_Segment* seg, size_t pos, size_t stop) {
+
+	const uint8_t* data = seg->data;
+
+	while (pos < stop) {
+		if (!TEXT[data[pos]]) {
+			pos++;
+			continue;
+		}
+		size_t k = pos;
+		while (k < stop && TEXT[data[k]]) {
+			k++;
+		}
+		if (k - pos >= STRING_MIN && k < stop && data[k] == 0) {
+			add_region(r, seg->addr + (uint32_t) pos, (uint32_t) (k + 1 - pos), DATA_ASCII);
+			k++;
+		}
+		pos = k;
+	}
+}
+
+/* One pass over each segment, merging the sorted code and LPM references:
+   a referenced address starts a string or a byte table running up to the
+   next reference or code; the rest of every gap is scanned for strings. */
+size_t data_regions(const AVR_Image* img, const AVR_Flow* flow, DataRegion** out) {
+
+	Regions r = { NULL, 0, 0 };
+	size_t	ci = 0, ri = 0;
+
+	init_text();
+
+	for (int s = 0; s < img->count; s++) {
+
+		const AVR_Segment* seg = &img->segs[s];
+		size_t		   pos = 0;
+
+		while (pos < seg->len) {
+
+			uint32_t addr = seg->addr + (uint32_t) pos;
+
+			while (ci < flow->code.count && flow->code.instrs[ci].addr + flow->code.instrs[ci].len <= addr) {
+				ci++;
+			}
+			if (ci < flow->code.count && flow->code.instrs[ci].addr <= addr) {
+				pos = flow->code.instrs[ci].addr + flow->code.instrs[ci].len - seg->addr;
+				continue;
+			}
+
+			/* The gap ends at the next instruction or the segment end. */
+			size_t gap_end = seg->len;
+			if (ci < flow->code.count && flow->code.instrs[ci].addr < seg->addr + seg->len) {
+				gap_end = flow->code.instrs[ci].addr - seg->addr;
+			}
+
+			while (ri < flow->nrefs && flow->refs[ri].addr < addr) {
+				ri++;
+			}
+			size_t next_ref = ri < flow->nrefs && flow->refs[ri].addr < seg->addr + gap_end
+				? flow->refs[ri].addr - seg->addr : gap_end;
+
+			if (next_ref > pos) {
+				scan_strings(&r, seg, pos, next_ref);
+				pos = next_ref;
+				continue;
+			}
+
+			/* Referenced: a string of any length, else bytes. */
+			size_t len = string_at(seg->data + pos, gap_end - pos, 1);
+			int    kind = DATA_ASCII;
+			if (len == 0) {
+				uint32_t want = flow->refs[ri].len;
+				while (ri < flow->nrefs && flow->refs[ri].addr == addr) {
+					ri++;
+				}
+				size_t end = ri < flow->nrefs && flow->refs[ri].addr < seg->addr + gap_end
+					? flow->refs[ri].addr - seg->addr : gap_end;
+				if (want != 0 && pos + want < end) {
+					end = pos + want;
+				}
+				len  = end - pos;
+				kind = DATA_BYTES;
+			}
+			add_region(&r, addr, (uint32_t) len, kind);
+			pos += len;
+		}
+	}
+
+	*out = r.list;
+	return r.count;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "avr_image.h"
+#include "avr_flow.h"
+
+/* Flash that is read rather than executed: what LPM/ELPM reads through a
+   tracked Z, and NUL-terminated runs of text outside reached code. */
+
+#define DATA_BYTES 1
+#define DATA_ASCII 2
+
+#define STRING_MIN 4 // printable characters before the NUL of an unreferenced string
+
+typedef struct DataRegion {
+
+	uint32_t addr;
+	uint32_t len;
+	int	 kind;
+
+} DataRegion;
+
+size_t data_regions(const AVR_Image* img, const AVR_Flow* flow, DataRegion** out);
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "avr_decode.h"
+#include "avr_disasm.h"
+
+/* Linear sweep of seg from offset i, up to the last instruction
+   starting before offset end. */
+static void decode_segment(const AVR_Segment* seg, uint32_t i, uint32_t end, AVR_Decoded* out, size_t* count) {
+
+	while (i + 1 < seg->len && i < end) {
+
+		AVR_Decoded* d = &out[(*count)++];
+		uint16_t word  = seg->data[i] | (seg->data[i + 1] << 8);
+
+		d->addr   = seg->addr + i;
+		d->opcode = word;
+		d->index  = AVR_DECODE_TABLE[word];
+		d->len    = 2;
+
+		if (d->index != INSTR_NONE && AVR_INSTRUCTION_SET[d->index].len == 32) {
+			if (i + 3 < seg->len) {
+				d->opcode = (word << 16) | seg->data[i + 2] | (seg->data[i + 3] << 8);
+				d->len    = 4;
+			}
+			else {
+				d->index = INSTR_NONE;
+			}
+		}
+		i += d->len;
+	}
+
+	if (i + 1 == seg->len && i < end) {
+		AVR_Decoded* d = &out[(*count)++];
+		d->addr   = seg->addr + i;
+		d->opcode = seg->data[i];
+		d->index  = INSTR_NONE;
+		d->len    = 1;
+	}
+}
+
+void decode_image(const AVR_Image* img, AVR_Program* prog) {
+
+	size_t words = 0;
+	for (int i = 0; i < img->count; i++) {
+		words += (img->segs[i].len + 1) / 2;
+	}
+
+	prog->count  = 0;
+	prog->instrs = xcalloc(words, sizeof(AVR_Decoded));
+
+	for (int i = 0; i < img->count; i++) {
+		decode_segment(&img->segs[i], 0, img->segs[i].len, prog->instrs, &prog->count);
+	}
+}
+
+/* Decodes the instructions starting in [start, end), sweeping every
+   segment from start or its first byte. out holds at least
+   (end - start + 1) / 2 + 1 entries per overlapped segment. */
+size_t decode_range(const AVR_Image* img, uint32_t start, uint32_t end, AVR_Decoded* out) {
+
+	size_t count = 0;
+	for (int i = 0; i < img->count; i++) {
+
+		const AVR_Segment* seg = &img->segs[i];
+		if (seg->addr >= end || seg->addr + seg->len <= start) {
+			continue;
+		}
+
+		uint32_t from = start > seg->addr ? start - seg->addr : 0;
+		decode_segment(seg, from, end - seg->addr, out, &count);
+	}
+	return count;
+}
+
+void free_program(AVR_Program* prog) {
+	free(prog->instrs);
+	prog->instrs = NULL;
+	prog->count  = 0;
+}
+
+/* Index of the entry covering addr, prog->count if there is none. */
+size_t program_find(const AVR_Program* prog, uint32_t addr) {
+
+	size_t lo = 0;
+	size_t hi = prog->count;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		const AVR_Decoded* d = &prog->instrs[mid];
+		if (addr < d->addr) hi = mid;
+		else if (addr >= d->addr + d->len) lo = mid + 1;
+		else return mid;
+	}
+	return prog->count;
+}
+
+int32_t decoded_operand(const AVR_Decoded* d, int i) {
+
+	AVR_Instr* instr = &AVR_INSTRUCTION_SET[d->index];
+	int length = d->len * 8;
+
+	return disasm_operand(
+		operand_bits_from_opcode(d->opcode, instr->operand_masks[i], length, instr->operand_types[i]),
+		instr->operand_types[i]
+	);
+}
+
+/* Bits of the opcode holding operand i, second word included. */
+uint32_t operand_field(const AVR_Decoded* d, int i) {
+
+	AVR_Instr* instr = &AVR_INSTRUCTION_SET[d->index];
+	uint32_t field   = (uint32_t) instr->operand_masks[i] << (d->len == 4 ? 16 : 0);
+
+	if (instr->operand_types[i] == 'h' || instr->operand_types[i] == 'i') {
+		field |= 0xffff;
+	}
+	return field;
+}
+
+/* Byte address a jump, branch or call transfers to, -1 if unknown. */
+int64_t branch_target(const AVR_Decoded* d) {
+
+	if (d->index == INSTR_NONE) {
+		return -1;
+	}
+
+	AVR_Instr* instr = &AVR_INSTRUCTION_SET[d->index];
+	for (int i = 0; i < instr->argc; i++) {
+		switch (instr->operand_types[i]) {
+			case 'l':
+			case 'L':
+				return (int64_t) d->addr + d->len + decoded_operand(d, i);
+			case 'h':
+				return decoded_operand(d, i);
+		}
+	}
+	return -1;
+}
+
+/* Targets of the vector table at address 0: consecutive JMP or RJMP
+   entries, the first being reset. Without a table the start of the
+   image is the only entry. */
+size_t program_vectors(const AVR_Program* prog, uint32_t** out) {
+
+	size_t count = 0;
+	*out = xcalloc(prog->count + 1, sizeof(uint32_t));
+
+	for (size_t i = 0; i < prog->count; i++) {
+		const AVR_Decoded* d = &prog->instrs[i];
+		if (d->addr != i * prog->instrs[0].len || d->len != prog->instrs[0].len ||
+		    d->index == INSTR_NONE || AVR_INSTRUCTION_SET[d->index].flow != FLOW_JUMP) {
+			break;
+		}
+		(*out)[count++] = (uint32_t) branch_target(d);
+	}
+	if (count == 0 && prog->count > 0) {
+		(*out)[count++] = prog->instrs[0].addr;
+	}
+	return count;
+}
+
+/* Registers and SREG flags d reads and writes, from the table's
+   effects resolved against the operands actually encoded. */
+void decoded_effects(const AVR_Decoded* d, uint64_t* use, uint64_t* def) {
+
+	*use = *def = 0;
+	if (d->index == INSTR_NONE) {
+		return;
+	}
+
+	AVR_Instr* instr = &AVR_INSTRUCTION_SET[d->index];
+	uint16_t   word  = (uint16_t) (d->len == 4 ? d->opcode >> 16 : d->opcode);
+
+	*use = instr->reg_use | EFFECT_SREG(instr->sreg_use);
+	*def = instr->reg_def | EFFECT_SREG(instr->sreg_def);
+
+	for (int i = 0; i < instr->argc; i++) {
+
+		const char* text = instr->operands[i];
+		uint64_t    regs = 0;
+
+		switch (instr->operand_types[i]) {
+			case 'r':
+			case 'd':
+			case 'a':
+				regs = REG(decoded_operand(d, i));
+				break;
+			case 'v':
+			case 'w':
+				regs = REG_PAIR(decoded_operand(d, i));
+				break;
+			case 'e':
+			case 'b':
+			case 'z': // X, -Y, Z+, Y+q, ...
+				regs  = REG_PAIR(26 + (text[*text == '-'] - 'X') * 2);
+				*use |= regs;
+				if (*text == '-' || (text[1] == '+' && text[2] != 'q')) {
+					*def |= regs;
+				}
+				continue;
+			case 'P': // IN/OUT on SREG itself
+				if (decoded_operand(d, i) == 0x3f) {
+					if (i == 1) *use |= EFFECT_SREG(0xff); else *def |= EFFECT_SREG(0xff);
+				}
+				continue;
+		}
+
+		if ((instr->operand_use >> i) & 1) *use |= regs;
+		if ((instr->operand_def >> i) & 1) *def |= regs;
+	}
+
+	if (instr->flow == FLOW_BRANCH) {
+		*use |= EFFECT_SREG(1 << (word & 7));
+	}
+	if ((word & 0xff0f) == 0x9408) { // BSET, BCLR and the named forms
+		*def |= EFFECT_SREG(1 << ((word >> 4) & 7));
+	}
+}
+
+int format_decoded(char* line, const AVR_Decoded* d, const char* note) {
+
+	if (d->index != INSTR_NONE) {
+		return format_instr(line, d->addr, d->opcode, d->len * 8, &AVR_INSTRUCTION_SET[d->index], note);
+	}
+	if (d->len == 1) {
+		return format_db(line, d->addr, (uint8_t) d->opcode);
+	}
+	return format_dw(line, d->addr, (uint16_t) d->opcode);
+}
+
+void print_decoded(const AVR_Decoded* d) {
+	print_decoded_note(d, NULL);
+}
+
+/* Same as print_decoded, with "; note" appended to instructions. */
+void print_decoded_note(const AVR_Decoded* d, const char* note) {
+
+	char line[DISASM_LINE_LEN];
+	format_decoded(line, d, note);
+	fputs(line, stdout);
+}
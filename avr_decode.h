@@ -0,0 +1,39 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "avr_image.h"
+#include "avr_instr.h"
+
+/* One linear-sweep decoded word or instruction of an AVR_Image. */
+typedef struct AVR_Decoded {
+
+	uint32_t addr;   // byte address
+	uint32_t opcode; // first word in the upper half for 32-bit instructions
+	uint8_t  index;  // AVR_INSTRUCTION_SET entry or INSTR_NONE for data
+	uint8_t  len;    // length in bytes
+
+} AVR_Decoded;
+
+typedef struct AVR_Program {
+
+	AVR_Decoded* instrs;
+	size_t count;
+
+} AVR_Program;
+
+void decode_image(const AVR_Image* img, AVR_Program* prog);
+void free_program(AVR_Program* prog);
+size_t decode_range(const AVR_Image* img, uint32_t start, uint32_t end, AVR_Decoded* out);
+
+/* Register r is bit r of an effect set, SREG flags follow from bit 32. */
+#define EFFECT_SREG(flags) ((uint64_t) (flags) << 32)
+
+size_t  program_find(const AVR_Program* prog, uint32_t addr);
+int32_t  decoded_operand(const AVR_Decoded* d, int i);
+uint32_t operand_field(const AVR_Decoded* d, int i);
+int64_t branch_target(const AVR_Decoded* d);
+size_t  program_vectors(const AVR_Program* prog, uint32_t** out);
+void    decoded_effects(const AVR_Decoded* d, uint64_t* use, uint64_t* def);
+int     format_decoded(char* line, const AVR_Decoded* d, const char* note);
+void    print_decoded(const AVR_Decoded* d);
+void    print_decoded_note(const AVR_Decoded* d, const char* note);
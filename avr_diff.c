@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "avr_diff.h"
+#include "avr_parse.h"
+#include "avr_decode.h"
+
+#define NO_MATCH ((size_t) -1)
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+/* Basic blocks are split at segment gaps, branch/call targets and after
+   every instruction that ends straight-line flow. Relative and absolute
+   targets leaving the block are hashed as wildcards so code that only
+   shifted still hashes equal; they are compared through the block
+   matching afterwards instead. */
+
+typedef struct Block {
+
+	size_t   first;
+	size_t   count;
+	uint64_t hash;
+	size_t   match;
+	bool	 changed;
+
+} Block;
+
+typedef struct Side {
+
+	AVR_Image   img;
+	AVR_Program prog;
+	Block*	    blocks;
+	size_t	    nblocks;
+	size_t*     block_of; // program index -> block
+
+} Side;
+
+typedef struct HashSlot {
+
+	uint64_t hash;
+	size_t	 count[2];
+	size_t	 block[2];
+	bool	 used;
+
+} HashSlot;
+
+static bool ends_block(const AVR_Decoded* d) {
+
+	if (d->index == INSTR_NONE) {
+		return false;
+	}
+
+	switch (AVR_INSTRUCTION_SET[d->index].flow) {
+		case FLOW_JUMP:
+		case FLOW_BRANCH:
+		case FLOW_IJUMP:
+		case FLOW_RET:
+			return true;
+	}
+	return false;
+}
+
+static uint32_t target_mask(const AVR_Decoded* d) {
+
+	AVR_Instr* instr = &AVR_INSTRUCTION_SET[d->index];
+	uint32_t mask = 0;
+
+	for (int i = 0; i < instr->argc; i++) {
+		char type = instr->operand_types[i];
+		if (type == 'l' || type == 'L' || type == 'h') mask |= operand_field(d, i);
+	}
+	return mask;
+}
+
+static uint64_t fnv(uint64_t hash, uint32_t value) {
+
+	for (int i = 0; i < 4; i++) {
+		hash ^= (value >> (i * 8)) & 0xff;
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+static uint64_t hash_block(const AVR_Program* prog, const Block* block) {
+
+	uint32_t start = prog->instrs[block->first].addr;
+	uint32_t end   = prog->instrs[block->first + block->count - 1].addr + prog->instrs[block->first + block->count - 1].len;
+	uint64_t hash  = FNV_OFFSET;
+
+	for (size_t i = block->first; i < block->first + block->count; i++) {
+
+		const AVR_Decoded* d = &prog->instrs[i];
+		if (d->index == INSTR_NONE) {
+			hash = fnv(fnv(hash, 0xffff0000 | d->len), d->opcode);
+			continue;
+		}
+
+		int64_t target = branch_target(d);
+		hash = fnv(hash, d->index);
+
+		if (target >= start && target < end) {
+			hash = fnv(hash, d->opcode);
+		}
+		else {
+			hash = fnv(hash, d->opcode & ~target_mask(d));
+		}
+	}
+	return hash;
+}
+
+static void split_blocks(Side* side) {
+
+	AVR_Program* prog = &side->prog;
+	bool* leader = xcalloc(prog->count, sizeof(bool));
+
+	for (size_t i = 0; i < prog->count; i++) {
+
+		const AVR_Decoded* d = &prog->instrs[i];
+		if (i == 0 || prog->instrs[i - 1].addr + prog->instrs[i - 1].len != d->addr) {
+			leader[i] = true;
+		}
+		if (ends_block(d) && i + 1 < prog->count) {
+			leader[i + 1] = true;
+		}
+
+		int64_t target = branch_target(d);
+		if (target >= 0 && target <= UINT32_MAX) {
+			size_t j = program_find(prog, (uint32_t) target);
+			if (j < prog->count && prog->instrs[j].addr == target) {
+				leader[j] = true;
+			}
+		}
+	}
+
+	side->blocks   = xcalloc(prog->count, sizeof(Block));
+	side->block_of = xcalloc(prog->count, sizeof(size_t));
+	side->nblocks  = 0;
+
+	for (size_t i = 0; i < prog->count; i++) {
+		if (leader[i]) {
+			Block* block = &side->blocks[side->nblocks++];
+			block->first = i;
+			block->count = 0;
+			block->match = NO_MATCH;
+		}
+		side->blocks[side->nblocks - 1].count++;
+		side->block_of[i] = side->nblocks - 1;
+	}
+
+	for (size_t b = 0; b < side->nblocks; b++) {
+		side->blocks[b].hash = hash_block(prog, &side->blocks[b]);
+	}
+	free(leader);
+}
+
+static HashSlot* slot_for(HashSlot* table, size_t mask, uint64_t hash) {
+
+	size_t i = (size_t) hash & mask;
+	while (table[i].used && table[i].hash != hash) {
+		i = (i + 1) & mask;
+	}
+	table[i].used = true;
+	table[i].hash = hash;
+	return &table[i];
+}
+
+static void link_blocks(Side* a, Side* b, size_t i, size_t j) {
+	a->blocks[i].match = j;
+	b->blocks[j].match = i;
+}
+
+static void match_blocks(Side* a, Side* b) {
+
+	size_t size = 16;
+	while (size < (a->nblocks + b->nblocks) * 2) {
+		size *= 2;
+	}
+
+	HashSlot* table = xcalloc(size, sizeof(HashSlot));
+	Side* sides[2] = { a, b };
+
+	for (int s = 0; s < 2; s++) {
+		for (size_t i = 0; i < sides[s]->nblocks; i++) {
+			HashSlot* slot = slot_for(table, size - 1, sides[s]->blocks[i].hash);
+			slot->count[s]++;
+			slot->block[s] = i;
+		}
+	}
+
+	// Blocks unique on both sides anchor the alignment
+	for (size_t i = 0; i < size; i++) {
+		if (table[i].used && table[i].count[0] == 1 && table[i].count[1] == 1) {
+			link_blocks(a, b, table[i].block[0], table[i].block[1]);
+		}
+	}
+	free(table);
+
+	// Grow anchors over repeated blocks in both directions
+	for (size_t i = 0; i + 1 < a->nblocks; i++) {
+		size_t j = a->blocks[i].match;
+		if (j != NO_MATCH && j + 1 < b->nblocks &&
+		    a->blocks[i + 1].match == NO_MATCH && b->blocks[j + 1].match == NO_MATCH &&
+		    a->blocks[i + 1].hash == b->blocks[j + 1].hash) {
+			link_blocks(a, b, i + 1, j + 1);
+		}
+	}
+	for (size_t i = a->nblocks; i-- > 1;) {
+		size_t j = a->blocks[i].match;
+		if (j != NO_MATCH && j > 0 &&
+		    a->blocks[i - 1].match == NO_MATCH && b->blocks[j - 1].match == NO_MATCH &&
+		    a->blocks[i - 1].hash == b->blocks[j - 1].hash) {
+			link_blocks(a, b, i - 1, j - 1);
+		}
+	}
+
+	// Pair what is left between two anchors as changed blocks
+	size_t j = 0;
+	for (size_t i = 0; i < a->nblocks; i++) {
+
+		if (a->blocks[i].match != NO_MATCH) {
+			j = a->blocks[i].match + 1;
+			continue;
+		}
+		if (j < b->nblocks && b->blocks[j].match == NO_MATCH) {
+			link_blocks(a, b, i, j);
+			a->blocks[i].changed = true;
+			b->blocks[j].changed = true;
+			j++;
+		}
+	}
+}
+
+/* A matched block whose jumps leave it still differs if the targets
+   do not land on corresponding blocks at the same offset. */
+static bool targets_agree(Side* a, Side* b, Block* block_a, Block* block_b) {
+
+	if (block_a->count != block_b->count) {
+		return false;
+	}
+
+	for (size_t k = 0; k < block_a->count; k++) {
+
+		const AVR_Decoded* da = &a->prog.instrs[block_a->first + k];
+		const AVR_Decoded* db = &b->prog.instrs[block_b->first + k];
+
+		int64_t ta = branch_target(da);
+		int64_t tb = branch_target(db);
+		if (ta < 0 && tb < 0) {
+			continue;
+		}
+
+		size_t ia = ta >= 0 && ta <= UINT32_MAX ? program_find(&a->prog, (uint32_t) ta) : a->prog.count;
+		size_t ib = tb >= 0 && tb <= UINT32_MAX ? program_find(&b->prog, (uint32_t) tb) : b->prog.count;
+
+		if (ia == a->prog.count || ib == b->prog.count) {
+			if ((ta - (int64_t) da->addr) != (tb - (int64_t) db->addr)) return false;
+			continue;
+		}
+
+		Block* ta_block = &a->blocks[a->block_of[ia]];
+		Block* tb_block = &b->blocks[b->block_of[ib]];
+		if (ta_block->match != b->block_of[ib] ||
+		    ta - a->prog.instrs[ta_block->first].addr != tb - b->prog.instrs[tb_block->first].addr) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void print_block(Side* side, Block* block, const char* prefix) {
+
+	for (size_t i = block->first; i < block->first + block->count; i++) {
+		fputs(prefix, stdout);
+		print_decoded(&side->prog.instrs[i]);
+	}
+}
+
+static uint32_t block_start(Side* side, Block* block) {
+	return side->prog.instrs[block->first].addr;
+}
+
+static uint32_t block_end(Side* side, Block* block) {
+	const AVR_Decoded* last = &side->prog.instrs[block->first + block->count - 1];
+	return last->addr + last->len;
+}
+
+static void load_side(Side* side, char* path, int format) {
+
+	image_init(&side->img);
+	load_image(path, format, &side->img);
+	decode_image(&side->img, &side->prog);
+	split_blocks(side);
+}
+
+static void free_side(Side* side) {
+	free(side->blocks);
+	free(side->block_of);
+	free_program(&side->prog);
+	image_free(&side->img);
+}
+
+int diff_images(char* path_a, char* path_b, int format) {
+
+	load_avr_instructions();
+
+	Side a, b;
+	load_side(&a, path_a, format);
+	load_side(&b, path_b, format);
+	match_blocks(&a, &b);
+
+	for (size_t i = 0; i < a.nblocks; i++) {
+		Block* block = &a.blocks[i];
+		if (block->match != NO_MATCH && !block->changed &&
+		    !targets_agree(&a, &b, block, &b.blocks[block->match])) {
+			block->changed = true;
+			b.blocks[block->match].changed = true;
+		}
+	}
+
+	size_t same = 0, shifted = 0, changed = 0, removed = 0, added = 0;
+	for (size_t i = 0; i < a.nblocks; i++) {
+
+		Block* block = &a.blocks[i];
+		if (block->match == NO_MATCH) {
+			printf("@@ -0x%04X,0x%04X @@ removed\n", block_start(&a, block), block_end(&a, block));
+			print_block(&a, block, "- ");
+			removed++;
+			continue;
+		}
+
+		Block* other = &b.blocks[block->match];
+		if (block->changed) {
+			printf("@@ -0x%04X,0x%04X +0x%04X,0x%04X @@ changed\n",
+				block_start(&a, block), block_end(&a, block), block_start(&b, other), block_end(&b, other));
+			print_block(&a, block, "- ");
+			print_block(&b, other, "+ ");
+			changed++;
+		}
+		else if (block_start(&a, block) != block_start(&b, other)) shifted++;
+		else same++;
+	}
+
+	for (size_t j = 0; j < b.nblocks; j++) {
+		Block* block = &b.blocks[j];
+		if (block->match == NO_MATCH) {
+			printf("@@ +0x%04X,0x%04X @@ added\n", block_start(&b, block), block_end(&b, block));
+			print_block(&b, block, "+ ");
+			added++;
+		}
+	}
+
+	printf("blocks: %zu unchanged, %zu shifted, %zu changed, %zu removed, %zu added\n",
+		same, shifted, changed, removed, added);
+
+	bool differ = changed || removed || added;
+	free_side(&a);
+	free_side(&b);
+	return differ;
+}
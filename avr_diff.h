@@ -0,0 +1,3 @@
+#pragma once
+
+int diff_images(char* path_a, char* path_b, int format);
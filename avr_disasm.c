@@ -116,6 +116,57 @@ int32_t operand_bits_from_opcode(uint32_t opcode, uint16_t mask, int length, cha
 	return bits;
 }
 
+/* Inverse of disasm_operand, -1 if the value cannot be encoded. */
+int32_t asm_operand(int32_t operand, char operand_type) {
+	switch (operand_type) {
+		case 'h':
+			return operand & 1 ? -1 : operand >> 1;
+		case 'a':
+		case 'd':
+			return operand < 16 ? -1 : operand - 16;
+		case 'v':
+			return operand & 1 ? -1 : operand / 2;
+		case 'w':
+			return operand < 24 || (operand & 1) ? -1 : (operand - 24) / 2;
+		case 'l':
+			return (operand & 1) || operand < -128 || operand > 126 ? -1 : (operand / 2) & 0x7f;
+		case 'L':
+			return (operand & 1) || operand < -4096 || operand > 4094 ? -1 : (operand / 2) & 0xfff;
+	}
+	return operand < 0 ? -1 : operand;
+}
+
+/* Inverse of operand_bits_from_opcode: scatters bits over the set bits
+   of mask, the low 16 bits of 'i' and 'h' going to the second word. */
+uint32_t operand_bits_to_opcode(int32_t bits, uint16_t mask, int length, char operand_type) {
+
+	uint32_t opcode = 0;
+	uint32_t low    = 0;
+	int shift       = 0;
+	bool i32        = length == 32;
+
+	if (operand_type == 'i' || operand_type == 'h') {
+		low  = bits & 0xffff;
+		bits = operand_type == 'h' ? bits >> 16 : 0;
+	}
+
+	if (mask == 0x3ff) {
+		// TST, CLR, LSL and ROL repeat Rd in both register fields
+		opcode = (bits & 0xf) | ((bits & 0x10) << 5) | ((bits & 0x1f) << 4);
+	}
+	else {
+		for (int i = 0; i < OPCODE_LEN; i++) {
+			if ((mask >> i) & 1) {
+				if ((bits >> shift) & 1) {
+					opcode |= 1 << i;
+				}
+				shift++;
+			}
+		}
+	}
+	return (opcode << (i32 ? 16 : 0)) | low;
+}
+
 void disasm_hexrec(int* temp_len, uint8_t temp_arr[], uint8_t uint_buff[], int len, size_t* offset) {
 
 	AVR_Instr avr_instr;
@@ -174,55 +225,111 @@ void disasm_hexrec(int* temp_len, uint8_t temp_arr[], uint8_t uint_buff[], int l
 	}
 }
 
-void print_db(size_t* addr, uint8_t byte) {
+int format_db(char* line, size_t addr, uint8_t byte) {
+	return snprintf(line, DISASM_LINE_LEN, "%02zx:    %02x             .db    0x%02x\n",
+		addr, byte, byte);
+}
 
-	printf("%02zx:    ", *addr);
-	printf("%02x             .db    0x%02x\n", 
-		byte, byte);
-	*addr += 1;
+int format_dw(char* line, size_t addr, uint16_t word) {
+	return snprintf(line, DISASM_LINE_LEN, "%02zx:    %02x %02x        .dw    0x%02x\n",
+		addr, (word >> 8) & 0xff, word & 0xff, word);
 }
 
-void print_dw(size_t* addr, uint16_t word) {
+/* Up to DB_ROW bytes as one .db line. */
+int format_db_row(char* line, size_t addr, const uint8_t* bytes, size_t n) {
 
-	printf("%02zx:    ", *addr);
-	printf("%02x %02x        .dw    0x%02x\n", 
-		(word >> 8) & 0xff, word & 0xff, word);
-	*addr += 2;
+	int len = snprintf(line, DISASM_LINE_LEN, "%02zx:    %15s.db    ", addr, "");
+	for (size_t i = 0; i < n; i++) {
+		len += snprintf(line + len, DISASM_LINE_LEN - len, i ? ", 0x%02x" : "0x%02x", bytes[i]);
+	}
+	return len + snprintf(line + len, DISASM_LINE_LEN - len, "\n");
 }
 
-void disasm_instr(size_t* addr, uint32_t opcode, int length, AVR_Instr instr) {
+/* Up to ASCII_ROW bytes of text as one .ascii line, NUL shown as \0. */
+int format_ascii(char* line, size_t addr, const uint8_t* bytes, size_t n) {
+
+	int len = snprintf(line, DISASM_LINE_LEN, "%02zx:    %15s.ascii \"", addr, "");
+	for (size_t i = 0; i < n; i++) {
+		switch (bytes[i]) {
+			case '\0': len += snprintf(line + len, DISASM_LINE_LEN - len, "\\0");  break;
+			case '\t': len += snprintf(line + len, DISASM_LINE_LEN - len, "\\t");  break;
+			case '\n': len += snprintf(line + len, DISASM_LINE_LEN - len, "\\n");  break;
+			case '\r': len += snprintf(line + len, DISASM_LINE_LEN - len, "\\r");  break;
+			case '"':  len += snprintf(line + len, DISASM_LINE_LEN - len, "\\\""); break;
+			case '\\': len += snprintf(line + len, DISASM_LINE_LEN - len, "\\\\"); break;
+			default:   len += snprintf(line + len, DISASM_LINE_LEN - len, "%c", bytes[i]);
+		}
+	}
+	return len + snprintf(line + len, DISASM_LINE_LEN - len, "\"\n");
+}
 
-	printf("%02zx:    ", *addr);
+int format_instr(char* line, size_t addr, uint32_t opcode, int length, const AVR_Instr* instr, const char* note) {
+
+	int n = snprintf(line, DISASM_LINE_LEN, "%02zx:    ", addr);
 	if (length == 32) {
-		printf("%02x %02x %02x %02x    ",
+		n += snprintf(line + n, DISASM_LINE_LEN - n, "%02x %02x %02x %02x    ",
 			opcode >> 24, (opcode >> 16) & 0xff, (opcode >> 8) & 0xff, opcode & 0xff
 		);
 	}
 	else {
-		printf("%02x %02x    ", (opcode >> 8) & 0xff, opcode & 0xff);
-		fputs("      ", stdout);
+		n += snprintf(line + n, DISASM_LINE_LEN - n, "%02x %02x          ", (opcode >> 8) & 0xff, opcode & 0xff);
 	}
 
-	fputs(instr.mnemonic, stdout);
-	fputs(strlen(instr.mnemonic) == 4 ? "   " : "    ", stdout);
+	n += snprintf(line + n, DISASM_LINE_LEN - n, "%s%s",
+		instr->mnemonic, strlen(instr->mnemonic) == 4 ? "   " : "    ");
 
 	int32_t  operand;
 	uint32_t operand_mask;
 	char	 operand_type;
-	char	 operand_format[7];
+	char	 operand_format[8];
 
-	for (int i = 0; i < instr.argc; i++) {
+	for (int i = 0; i < instr->argc; i++) {
 
-		operand_type = instr.operand_types[i];
-		operand_mask = instr.operand_masks[i];
+		operand_type = instr->operand_types[i];
+		operand_mask = instr->operand_masks[i];
 		operand	     = disasm_operand(
 			operand_bits_from_opcode(opcode, operand_mask, length, operand_type),
 			operand_type
 		);
 
-		get_operand_format(operand_type, operand_format, instr.operands[i]);
-		printf(operand_format, operand);
-		fputs(" ", stdout);
+		get_operand_format(operand_type, operand_format, (char*) instr->operands[i]);
+		strcat(operand_format, " ");
+		n += snprintf(line + n, DISASM_LINE_LEN - n, operand_format, operand);
+	}
+	if (note != NULL) {
+		n += snprintf(line + n, DISASM_LINE_LEN - n, "; %s", note);
 	}
-	fputs("\n", stdout);
+	if (n > DISASM_LINE_LEN - 2) {
+		n = DISASM_LINE_LEN - 2;
+	}
+	line[n++] = '\n';
+	line[n]   = '\0';
+	return n;
+}
+
+void print_db(size_t* addr, uint8_t byte) {
+
+	char line[DISASM_LINE_LEN];
+	format_db(line, *addr, byte);
+	fputs(line, stdout);
+	*addr += 1;
+}
+
+void print_dw(size_t* addr, uint16_t word) {
+
+	char line[DISASM_LINE_LEN];
+	format_dw(line, *addr, word);
+	fputs(line, stdout);
+	*addr += 2;
+}
+
+void disasm_instr(size_t* addr, uint32_t opcode, int length, AVR_Instr instr) {
+	disasm_instr_note(addr, opcode, length, instr, NULL);
+}
+
+void disasm_instr_note(size_t* addr, uint32_t opcode, int length, AVR_Instr instr, const char* note) {
+
+	char line[DISASM_LINE_LEN];
+	format_instr(line, *addr, opcode, length, &instr, note);
+	fputs(line, stdout);
 }
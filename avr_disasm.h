@@ -1,12 +1,26 @@
+#pragma once
 #include <stdint.h>
 #include <stddef.h>
 #include "avr_instr.h"
 
+#define DISASM_LINE_LEN 256
+#define DB_ROW		8
+#define ASCII_ROW	16
+
 int32_t disasm_operand(int32_t operand, char operand_type);
 int32_t operand_bits_from_opcode(uint32_t opcode, uint16_t mask, int length, char operand_type);
+int32_t asm_operand(int32_t operand, char operand_type);
+uint32_t operand_bits_to_opcode(int32_t bits, uint16_t mask, int length, char operand_type);
+
+int format_db(char* line, size_t addr, uint8_t  byte);
+int format_dw(char* line, size_t addr, uint16_t word);
+int format_db_row(char* line, size_t addr, const uint8_t* bytes, size_t n);
+int format_ascii(char* line, size_t addr, const uint8_t* bytes, size_t n);
+int format_instr(char* line, size_t addr, uint32_t opcode, int length, const AVR_Instr* instr, const char* note);
 
 void print_db(size_t* addr, uint8_t  byte);
 void print_dw(size_t* addr, uint16_t word);
 
 void disasm_instr(size_t* addr, uint32_t opcode, int length, AVR_Instr instr);
+void disasm_instr_note(size_t* addr, uint32_t opcode, int length, AVR_Instr instr, const char* note);
 void disasm_hexrec(int* temp_len, uint8_t temp_arr[], uint8_t uint_buff[], int len, size_t* offset);
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avr_elf.h"
+#include "avr_parse.h"
+
+#define PT_LOAD		 1
+#define SHT_PROGBITS	 1
+#define SHT_SYMTAB	 2
+#define SHF_EXECINSTR	 4
+#define STT_FUNC	 2
+#define EHDR_SIZE	 52
+
+/* Fields are read byte-wise, so neither the host's byte order nor its
+   structure layout matter. */
+
+static uint16_t rd16(const uint8_t* p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t rd32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void bad_elf(char* path, const char* why) {
+	fprintf(stderr, "ihex2avr: %s: %s\n", path, why);
+	exit(EXIT_FAILURE);
+}
+
+static bool in_file(uint32_t offset, uint64_t bytes, size_t size) {
+	return offset <= size && bytes <= size - offset;
+}
+
+static int cmp_symbol(const void* a, const void* b) {
+
+	const ElfSymbol* x = a;
+	const ElfSymbol* y = b;
+	return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+static void read_symbols(char* path, const uint8_t* elf, size_t size, const uint8_t* sh, ElfSymbol** syms, size_t* nsyms) {
+
+	uint32_t shentsize = rd16(elf + 46);
+	uint32_t shnum	   = rd16(elf + 48);
+	size_t	 cap	   = 64;
+
+	*syms  = xcalloc(cap, sizeof(ElfSymbol));
+	*nsyms = 0;
+
+	for (uint32_t i = 0; i < shnum; i++) {
+
+		const uint8_t* s = sh + i * shentsize;
+		if (rd32(s + 4) != SHT_SYMTAB || rd32(s + 24) >= shnum) {
+			continue;
+		}
+
+		const uint8_t* strtab  = sh + rd32(s + 24) * shentsize;
+		uint32_t       str_off = rd32(strtab + 16);
+		uint32_t       str_len = rd32(strtab + 20);
+		uint32_t       off     = rd32(s + 16);
+		uint32_t       len     = rd32(s + 20);
+		uint32_t       entsize = rd32(s + 36) ? rd32(s + 36) : 16;
+
+		if (!in_file(off, len, size) || !in_file(str_off, str_len, size)) {
+			bad_elf(path, "symbol table outside the file");
+		}
+
+		for (uint32_t e = 0; e + 16 <= len; e += entsize) {
+
+			const uint8_t* sym   = elf + off + e;
+			uint32_t       name  = rd32(sym);
+			uint32_t       value = rd32(sym + 4);
+
+			if ((sym[12] & 0xf) != STT_FUNC || rd16(sym + 14) == 0 || value >= ELF_FLASH_END || name >= str_len) {
+				continue;
+			}
+			if (*nsyms == cap) {
+				cap  *= 2;
+				*syms = xrealloc(*syms, cap * sizeof(ElfSymbol));
+			}
+			ElfSymbol* out = &(*syms)[(*nsyms)++];
+			out->addr = value;
+			snprintf(out->name, sizeof out->name, "%.*s", (int) strnlen((const char*) elf + str_off + name, str_len - name),
+				 (const char*) elf + str_off + name);
+		}
+	}
+	qsort(*syms, *nsyms, sizeof(ElfSymbol), cmp_symbol);
+}
+
+bool is_elf(const uint8_t* data, size_t size) {
+	return size >= 4 && !memcmp(data, "\x7f" "ELF", 4);
+}
+
+/* elf is the whole file as read or mapped from path; syms may be NULL
+   when only the image is wanted. */
+void load_elf(char* path, const uint8_t* elf, size_t size, AVR_Image* img, ElfSymbol** syms, size_t* nsyms) {
+
+	if (size < EHDR_SIZE || !is_elf(elf, size)) bad_elf(path, "not an ELF file");
+	if (elf[4] != 1 || elf[5] != 1)			      bad_elf(path, "not a 32-bit little-endian ELF file");
+
+	uint32_t phoff	   = rd32(elf + 28);
+	uint32_t shoff	   = rd32(elf + 32);
+	uint32_t phentsize = rd16(elf + 42);
+	uint32_t phnum	   = rd16(elf + 44);
+	uint32_t shentsize = rd16(elf + 46);
+	uint32_t shnum	   = rd16(elf + 48);
+
+	if (phnum && (phentsize < 32 || !in_file(phoff, (uint64_t) phnum * phentsize, size))) bad_elf(path, "bad program headers");
+	if (shnum && (shentsize < 40 || !in_file(shoff, (uint64_t) shnum * shentsize, size))) bad_elf(path, "bad section headers");
+
+	/* Segments by load address: .data's initializers follow .text in
+	   flash while its virtual address is in SRAM. */
+	for (uint32_t i = 0; i < phnum; i++) {
+
+		const uint8_t* ph     = elf + phoff + i * phentsize;
+		uint32_t       offset = rd32(ph + 4);
+		uint32_t       paddr  = rd32(ph + 12);
+		uint32_t       filesz = rd32(ph + 16);
+
+		if (rd32(ph) != PT_LOAD || filesz == 0 || paddr >= ELF_FLASH_END) {
+			continue;
+		}
+		if (!in_file(offset, filesz, size)) bad_elf(path, "segment outside the file");
+		image_write(img, paddr, elf + offset, filesz);
+	}
+
+	/* A relocatable object has sections only. */
+	for (uint32_t i = 0; phnum == 0 && i < shnum; i++) {
+
+		const uint8_t* s      = elf + shoff + i * shentsize;
+		uint32_t       addr   = rd32(s + 12);
+		uint32_t       offset = rd32(s + 16);
+		uint32_t       len    = rd32(s + 20);
+
+		if (rd32(s + 4) != SHT_PROGBITS || !(rd32(s + 8) & SHF_EXECINSTR) || len == 0) {
+			continue;
+		}
+		if (!in_file(offset, len, size)) bad_elf(path, "section outside the file");
+		image_write(img, addr, elf + offset, len);
+	}
+
+	if (syms != NULL) {
+		read_symbols(path, elf, size, elf + shoff, syms, nsyms);
+	}
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "avr_image.h"
+
+/* ELF32 little-endian input: the flash contents of the loadable
+   segments (.text, .data initializers) at their load addresses, or of
+   the executable sections of an object without program headers, and
+   the function symbols. */
+
+#define ELF_FLASH_END 0x800000 // avr-ld places SRAM and EEPROM above flash
+
+typedef struct ElfSymbol {
+
+	uint32_t addr;
+	char	 name[64];
+
+} ElfSymbol;
+
+bool is_elf(const uint8_t* data, size_t size);
+void load_elf(char* path, const uint8_t* elf, size_t size, AVR_Image* img, ElfSymbol** syms, size_t* nsyms);
@@ -0,0 +1,728 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avr_flow.h"
+#include "avr_parse.h"
+#include "avr_disasm.h"
+#include "avr_live.h"
+#include "avr_data.h"
+
+#define TABLE_MAX  256  // entries read from a jump table whose size is unknown
+#define TABLE_HARD 1024 // upper limit even with a known bound
+#define NOTE_TARGETS 16
+
+/* Constant-propagation state carried along a walk. Registers are tracked
+   byte-wise; Z may instead hold an unknown index plus a known base, the
+   shape of a switch table lookup. */
+typedef struct ZState {
+
+	uint32_t known;		// registers holding a known value
+	uint8_t	 value[32];
+	uint8_t	 bound[32];	// value < bound when nonzero, from CPI + BRSH/BRLO
+	int	 carry;		// C of the last SUBI/SBCI or ADD/ADC, -1 if unknown
+	bool	 indexed;
+	uint16_t zbase;
+	uint16_t zcount;	// index bound, 0 if unknown
+	int	 cmp_reg;	// register of the last CPI, -1 if none
+	uint8_t	 cmp_value;
+
+} ZState;
+
+typedef struct Item {
+
+	uint32_t addr;
+	ZState	 state;
+
+} Item;
+
+typedef struct Walk {
+
+	const AVR_Image* img;
+	uint8_t**	 marks; // per segment, 1 at every instruction reached, 2 on data read by LPM
+
+	Item*		 work;
+	size_t		 nwork;
+	size_t		 work_cap;
+
+	AVR_Decoded*	 code;
+	size_t		 ncode;
+	size_t		 code_cap;
+
+	IndirectTarget*	 targets;
+	size_t		 ntargets;
+	size_t		 targets_cap;
+
+	uint32_t*	 unresolved;
+	size_t		 nunresolved;
+	size_t		 unresolved_cap;
+
+	DataRef*	 refs;
+	size_t		 nrefs;
+	size_t		 refs_cap;
+
+} Walk;
+
+static bool z_known(const ZState* s) {
+	return (s->known & REG_PAIR(30)) == REG_PAIR(30);
+}
+
+static uint16_t z_value(const ZState* s) {
+	return s->value[30] | (s->value[31] << 8);
+}
+
+static void set_reg(ZState* s, int r, uint8_t value) {
+	s->known   |= REG(r);
+	s->value[r] = value;
+	s->bound[r] = 0;
+}
+
+static void set_z(ZState* s, uint16_t z) {
+	set_reg(s, 30, z & 0xff);
+	set_reg(s, 31, z >> 8);
+	s->indexed = false;
+}
+
+static void clear_state(ZState* s) {
+	memset(s, 0, sizeof *s);
+	s->carry   = -1;
+	s->cmp_reg = -1;
+}
+
+static uint8_t* mark_of(const Walk* w, uint32_t addr) {
+
+	AVR_Segment* seg = image_find(w->img, addr);
+	return seg != NULL ? &w->marks[seg - w->img->segs][addr - seg->addr] : NULL;
+}
+
+/* Instruction starting at addr, false outside the image. */
+static bool decode_at(const AVR_Image* img, uint32_t addr, AVR_Decoded* d) {
+
+	AVR_Decoded tmp[2];
+	size_t	    n = decode_range(img, addr, addr + 1, tmp);
+	for (size_t i = 0; i < n; i++) {
+		if (tmp[i].addr == addr) {
+			*d = tmp[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool is_mnemonic(const AVR_Decoded* d, const char* mnemonic) {
+	return d->index != INSTR_NONE && !strcmp(AVR_INSTRUCTION_SET[d->index].mnemonic, mnemonic);
+}
+
+static bool is_lpm(const AVR_Decoded* d, const char* pointer) {
+	return (is_mnemonic(d, "LPM") || is_mnemonic(d, "ELPM")) &&
+	       AVR_INSTRUCTION_SET[d->index].argc == 2 && !strcmp(AVR_INSTRUCTION_SET[d->index].operands[1], pointer);
+}
+
+static void push_item(Walk* w, uint32_t addr, const ZState* state) {
+
+	if (w->nwork == w->work_cap) {
+		w->work_cap = w->work_cap ? w->work_cap * 2 : 256;
+		w->work	    = xrealloc(w->work, w->work_cap * sizeof(Item));
+	}
+	w->work[w->nwork].addr	  = addr;
+	w->work[w->nwork++].state = *state;
+}
+
+static void push_entry(Walk* w, uint32_t addr) {
+
+	ZState empty;
+	clear_state(&empty);
+	push_item(w, addr, &empty);
+}
+
+static void add_target(Walk* w, uint32_t site, uint32_t target) {
+
+	if (w->ntargets == w->targets_cap) {
+		w->targets_cap = w->targets_cap ? w->targets_cap * 2 : 64;
+		w->targets     = xrealloc(w->targets, w->targets_cap * sizeof(IndirectTarget));
+	}
+	w->targets[w->ntargets].site	 = site;
+	w->targets[w->ntargets++].target = target;
+	push_entry(w, target);
+}
+
+static void add_unresolved(Walk* w, uint32_t site) {
+
+	if (w->nunresolved == w->unresolved_cap) {
+		w->unresolved_cap = w->unresolved_cap ? w->unresolved_cap * 2 : 64;
+		w->unresolved	  = xrealloc(w->unresolved, w->unresolved_cap * sizeof(uint32_t));
+	}
+	w->unresolved[w->nunresolved++] = site;
+}
+
+/* Flash read by an LPM/ELPM with Z known, or indexed from a known base.
+   The bytes read are marked so the walk never decodes them. */
+static void add_ref(Walk* w, const ZState* s) {
+
+	DataRef ref;
+
+	if (z_known(s)) {
+		ref.addr = z_value(s);
+		ref.len	 = 0;
+	}
+	else if (s->indexed) {
+		ref.addr = s->zbase;
+		ref.len	 = s->zcount <= TABLE_HARD ? s->zcount : 0;
+	}
+	else {
+		return;
+	}
+
+	if (w->nrefs == w->refs_cap) {
+		w->refs_cap = w->refs_cap ? w->refs_cap * 2 : 64;
+		w->refs	    = xrealloc(w->refs, w->refs_cap * sizeof(DataRef));
+	}
+	w->refs[w->nrefs++] = ref;
+
+	for (uint32_t i = 0; i < (ref.len ? ref.len : 1); i++) {
+		uint8_t* mark = mark_of(w, ref.addr + i);
+		if (mark != NULL && *mark == 0) *mark = 2;
+	}
+}
+
+/* avr-gcc's __tablejump2__ (or __tablejump__ without the shift):
+	[LSL r30; ROL r31;] LPM rX,Z+; LPM r31,Z; MOV r30,rX; IJMP
+   Returns 1 if Z is a word address, 0 if a byte address, -1 otherwise. */
+static int table_helper(const AVR_Image* img, uint32_t addr) {
+
+	AVR_Decoded d;
+	int	    shift = 0;
+
+	if (!decode_at(img, addr, &d)) {
+		return -1;
+	}
+	if (is_mnemonic(&d, "ADD") && decoded_operand(&d, 0) == 30 && decoded_operand(&d, 1) == 30) {
+		if (!decode_at(img, addr += 2, &d) ||
+		    !is_mnemonic(&d, "ADC") || decoded_operand(&d, 0) != 31 || decoded_operand(&d, 1) != 31 ||
+		    !decode_at(img, addr += 2, &d)) {
+			return -1;
+		}
+		shift = 1;
+	}
+	if (!is_lpm(&d, "Z+")) {
+		return -1;
+	}
+
+	int tmp = decoded_operand(&d, 0);
+	if (!decode_at(img, addr += 2, &d) || !is_lpm(&d, "Z") || decoded_operand(&d, 0) != 31 ||
+	    !decode_at(img, addr += 2, &d) || !is_mnemonic(&d, "MOV") ||
+	    decoded_operand(&d, 0) != 30 || decoded_operand(&d, 1) != tmp ||
+	    !decode_at(img, addr += 2, &d) || (!is_mnemonic(&d, "IJMP") && !is_mnemonic(&d, "EIJMP"))) {
+		return -1;
+	}
+	return shift;
+}
+
+/* Entry count of a table: the compare bound if there is one, else as
+   long as valid reports entries that look right. */
+static int table_entries(const ZState* s, int entry_max) {
+	return s->zcount != 0 && s->zcount <= TABLE_HARD ? s->zcount : entry_max;
+}
+
+/* site jumps through the word table read by a table_helper. */
+static void resolve_table(Walk* w, uint32_t site, const ZState* s, int shift) {
+
+	uint32_t base;
+	int	 count;
+
+	if (z_known(s)) {
+		base  = shift ? z_value(s) * 2u : z_value(s);
+		count = 1;
+	}
+	else if (s->indexed) {
+		base  = shift ? s->zbase * 2u : s->zbase;
+		count = table_entries(s, TABLE_MAX);
+	}
+	else {
+		add_unresolved(w, site);
+		return;
+	}
+
+	int found = 0;
+	for (int i = 0; i < count; i++) {
+
+		uint16_t    word;
+		AVR_Decoded d;
+
+		if (!image_word(w->img, base + i * 2, &word) ||
+		    !decode_at(w->img, word * 2u, &d) || d.index == INSTR_NONE) {
+			if (s->zcount == 0) break;
+			continue;
+		}
+		add_target(w, site, word * 2u);
+		found++;
+	}
+	if (found == 0) {
+		add_unresolved(w, site);
+	}
+}
+
+/* The IJMP of a table_helper, whose targets belong to its callers. */
+static bool helper_tail(const AVR_Image* img, uint32_t site) {
+	return (site >= 6 && table_helper(img, site - 6) == 0) || (site >= 10 && table_helper(img, site - 10) == 1);
+}
+
+/* IJMP/ICALL on Z: a constant, or an index into a run of RJMPs. */
+static void resolve_ijmp(Walk* w, uint32_t site, const ZState* s, bool call) {
+
+	if (z_known(s)) {
+		add_target(w, site, z_value(s) * 2u);
+		return;
+	}
+	if (!s->indexed || call) {
+		add_unresolved(w, site);
+		return;
+	}
+
+	int count = table_entries(s, TABLE_MAX);
+	int found = 0;
+	for (int i = 0; i < count; i++) {
+		AVR_Decoded d;
+		uint32_t    entry = (s->zbase + i) * 2u;
+		if (!decode_at(w->img, entry, &d) || !is_mnemonic(&d, "RJMP")) {
+			break;
+		}
+		add_target(w, site, entry);
+		found++;
+	}
+	if (found == 0) {
+		add_unresolved(w, site);
+	}
+}
+
+static void transfer(const AVR_Image* img, ZState* s, const AVR_Decoded* d) {
+
+	AVR_Instr* instr = &AVR_INSTRUCTION_SET[d->index];
+	ZState	   old	 = *s;
+	uint64_t   use, def;
+	int	   a = instr->argc > 0 ? decoded_operand(d, 0) : 0;
+	int	   b = instr->argc > 1 ? decoded_operand(d, 1) : 0;
+
+	decoded_effects(d, &use, &def);
+
+	/* Whatever is written is unknown unless a case below knows better. */
+	s->known &= ~(uint32_t) def;
+	for (int r = 0; r < 32; r++) {
+		if ((def >> r) & 1) s->bound[r] = 0;
+	}
+	if (def & REG_PAIR(30)) {
+		s->indexed = false;
+	}
+	if (def & EFFECT_SREG(FLAG_C)) {
+		s->carry   = -1;
+		s->cmp_reg = -1;
+	}
+
+	if (is_mnemonic(d, "LDI") || is_mnemonic(d, "SER")) {
+		set_reg(s, a, is_mnemonic(d, "SER") ? 0xff : (uint8_t) b);
+	}
+	else if (is_mnemonic(d, "EOR") && a == b) { // CLR
+		set_reg(s, a, 0);
+	}
+	else if (is_mnemonic(d, "MOV") || is_mnemonic(d, "MOVW")) {
+		int n = is_mnemonic(d, "MOVW") ? 2 : 1;
+		for (int i = 0; i < n; i++) {
+			if ((old.known >> (b + i)) & 1) set_reg(s, a + i, old.value[b + i]);
+			s->bound[a + i] = old.bound[b + i];
+		}
+		if (a == 30 && n == 2 && !z_known(s)) { // MOVW r30,rX: Z = index
+			s->indexed = true;
+			s->zbase   = 0;
+			s->zcount  = old.bound[b];
+		}
+	}
+	else if (is_mnemonic(d, "SUBI") || is_mnemonic(d, "SBCI")) {
+		int  c	     = is_mnemonic(d, "SBCI") ? old.carry : 0;
+		bool known_a = (old.known >> a) & 1;
+		if (known_a && c >= 0) {
+			set_reg(s, a, (uint8_t) (old.value[a] - b - c));
+			s->carry = old.value[a] < b + c;
+		}
+		if (old.indexed && (a == 30 || a == 31)) { // Z = index - (-table)
+			s->indexed = true;
+			s->zbase   = old.zbase - (uint16_t) (a == 31 ? b << 8 : b);
+		}
+	}
+	else if (is_mnemonic(d, "ADD") || is_mnemonic(d, "ADC")) {
+		int  c	     = is_mnemonic(d, "ADC") ? old.carry : 0;
+		bool known_a = (old.known >> a) & 1;
+		bool known_b = (old.known >> b) & 1;
+		if (known_a && known_b && c >= 0) {
+			set_reg(s, a, (uint8_t) (old.value[a] + old.value[b] + c));
+			s->carry = old.value[a] + old.value[b] + c > 0xff;
+		}
+		if (is_mnemonic(d, "ADD") && a == 30 && b != 30 && z_known(&old) && !known_b) { // Z = table + index
+			s->indexed = true;
+			s->zbase   = z_value(&old);
+			s->zcount  = old.bound[b];
+		}
+		if (is_mnemonic(d, "ADC") && a == 31 && old.indexed) {
+			s->indexed = true;
+		}
+	}
+	else if ((is_mnemonic(d, "ADIW") || is_mnemonic(d, "SBIW")) && a == 30) {
+		int delta = is_mnemonic(d, "ADIW") ? b : -b;
+		if (z_known(&old)) {
+			set_z(s, (uint16_t) (z_value(&old) + delta));
+		}
+		else if (old.indexed) {
+			s->indexed = true;
+			s->zbase   = (uint16_t) (old.zbase + delta);
+		}
+	}
+	else if (is_mnemonic(d, "CPI")) {
+		s->cmp_reg   = a;
+		s->cmp_value = (uint8_t) b;
+	}
+	else if (is_mnemonic(d, "CPC")) { // high byte of a 16-bit compare
+		s->cmp_reg   = old.cmp_reg;
+		s->cmp_value = old.cmp_value;
+	}
+	else if ((is_mnemonic(d, "LPM") || is_mnemonic(d, "ELPM")) && z_known(&old)) {
+		uint8_t byte;
+		int	reg = instr->argc == 0 ? 0 : a;
+		if (image_read(img, z_value(&old), &byte)) {
+			set_reg(s, reg, byte);
+		}
+		if (instr->argc == 2 && !strcmp(instr->operands[1], "Z+") && reg != 30 && reg != 31) {
+			set_z(s, (uint16_t) (z_value(&old) + 1));
+		}
+	}
+}
+
+/* Calls clobber the registers the calling convention lets them. */
+static void clobber(ZState* s) {
+
+	s->known &= ~ABI_CLOBBER;
+	for (int r = 0; r < 32; r++) {
+		if ((ABI_CLOBBER >> r) & 1) s->bound[r] = 0;
+	}
+	s->indexed = false;
+	s->carry   = -1;
+	s->cmp_reg = -1;
+}
+
+static void walk(Walk* w, uint32_t addr, ZState s) {
+
+	AVR_Decoded d;
+
+	for (;;) {
+
+		uint8_t* mark = mark_of(w, addr);
+		if (mark == NULL || *mark || !decode_at(w->img, addr, &d) || d.index == INSTR_NONE) {
+			return;
+		}
+		*mark = 1;
+
+		if (w->ncode == w->code_cap) {
+			w->code_cap = w->code_cap ? w->code_cap * 2 : 1024;
+			w->code	    = xrealloc(w->code, w->code_cap * sizeof(AVR_Decoded));
+		}
+		w->code[w->ncode++] = d;
+
+		int	 flow	= AVR_INSTRUCTION_SET[d.index].flow;
+		int64_t	 target = branch_target(&d);
+		uint32_t next	= d.addr + d.len;
+
+		switch (flow) {
+
+			case FLOW_BRANCH: {
+				/* CPI rX,N; BRLO/BRSH: rX < N on the lower side. */
+				ZState taken = s;
+				if ((d.opcode & 7) == 0 && s.cmp_reg >= 0) {
+					ZState* lower = d.opcode & 0x0400 ? &s : &taken;
+					lower->bound[s.cmp_reg] = s.cmp_value;
+				}
+				if (target >= 0) push_item(w, (uint32_t) target, &taken);
+				break;
+			}
+			case FLOW_SKIP: {
+				AVR_Decoded skipped;
+				transfer(w->img, &s, &d);
+				if (decode_at(w->img, next, &skipped)) {
+					push_item(w, next + skipped.len, &s);
+				}
+				addr = next;
+				continue;
+			}
+			case FLOW_JUMP: {
+				int shift = table_helper(w->img, (uint32_t) target);
+				if (shift >= 0) {
+					resolve_table(w, d.addr, &s, shift);
+				}
+				push_item(w, (uint32_t) target, &s);
+				return;
+			}
+			case FLOW_CALL: {
+				int shift = target != next ? table_helper(w->img, (uint32_t) target) : -1;
+				if (shift >= 0) {
+					resolve_table(w, d.addr, &s, shift);
+				}
+				if (target != next) {
+					push_entry(w, (uint32_t) target);
+					clobber(&s);
+				}
+				addr = next;
+				continue;
+			}
+			case FLOW_IJUMP:
+				if (!helper_tail(w->img, d.addr)) {
+					resolve_ijmp(w, d.addr, &s, false);
+				}
+				return;
+			case FLOW_ICALL:
+				resolve_ijmp(w, d.addr, &s, true);
+				clobber(&s);
+				addr = next;
+				continue;
+			case FLOW_RET:
+				return;
+		}
+
+		if (is_mnemonic(&d, "LPM") || is_mnemonic(&d, "ELPM")) {
+			add_ref(w, &s);
+		}
+		transfer(w->img, &s, &d);
+		addr = next;
+	}
+}
+
+static int cmp_decoded(const void* a, const void* b) {
+
+	uint32_t x = ((const AVR_Decoded*) a)->addr;
+	uint32_t y = ((const AVR_Decoded*) b)->addr;
+	return (x > y) - (x < y);
+}
+
+static int cmp_target(const void* a, const void* b) {
+
+	const IndirectTarget* x = a;
+	const IndirectTarget* y = b;
+	if (x->site != y->site) {
+		return (x->site > y->site) - (x->site < y->site);
+	}
+	return (x->target > y->target) - (x->target < y->target);
+}
+
+static int cmp_ref(const void* a, const void* b) {
+
+	const DataRef* x = a;
+	const DataRef* y = b;
+	if (x->addr != y->addr) {
+		return (x->addr > y->addr) - (x->addr < y->addr);
+	}
+	return (x->len < y->len) - (x->len > y->len);
+}
+
+static int cmp_u32(const void* a, const void* b) {
+
+	uint32_t x = *(const uint32_t*) a;
+	uint32_t y = *(const uint32_t*) b;
+	return (x > y) - (x < y);
+}
+
+/* Walks from every vector. Resolved indirect targets go on the same
+   worklist as branch targets, so only newly reached code is walked. */
+void flow_analyze(const AVR_Image* img, AVR_Flow* flow) {
+
+	Walk w;
+	memset(&w, 0, sizeof w);
+	w.img	= img;
+	w.marks = xcalloc(img->count + 1, sizeof(uint8_t*));
+	for (int i = 0; i < img->count; i++) {
+		w.marks[i] = xcalloc(img->segs[i].len + 1, 1);
+	}
+
+	AVR_Program linear;
+	uint32_t*   vectors;
+	decode_image(img, &linear);
+	size_t nvectors = program_vectors(&linear, &vectors);
+
+	/* Walk the vector slots themselves, in reverse so reset goes first. */
+	bool table = linear.count > 0 && linear.instrs[0].index != INSTR_NONE &&
+		     AVR_INSTRUCTION_SET[linear.instrs[0].index].flow == FLOW_JUMP;
+	for (size_t i = nvectors; i-- > 0;) {
+		push_entry(&w, table ? (uint32_t) (i * linear.instrs[0].len) : vectors[i]);
+	}
+	free_program(&linear);
+
+	while (w.nwork > 0) {
+		Item item = w.work[--w.nwork];
+		walk(&w, item.addr, item.state);
+	}
+
+	qsort(w.code, w.ncode, sizeof(AVR_Decoded), cmp_decoded);
+	if (w.ntargets > 0)    qsort(w.targets, w.ntargets, sizeof(IndirectTarget), cmp_target);
+	if (w.nunresolved > 0) qsort(w.unresolved, w.nunresolved, sizeof(uint32_t), cmp_u32);
+	if (w.nrefs > 0)       qsort(w.refs, w.nrefs, sizeof(DataRef), cmp_ref);
+
+	flow->code.instrs = w.code;
+	flow->code.count  = w.ncode;
+	flow->targets	  = w.targets;
+	flow->ntargets	  = w.ntargets;
+	flow->unresolved  = w.unresolved;
+	flow->nunresolved = w.nunresolved;
+	flow->refs	  = w.refs;
+	flow->nrefs	  = w.nrefs;
+
+	for (int i = 0; i < img->count; i++) {
+		free(w.marks[i]);
+	}
+	free(w.marks);
+	free(w.work);
+	free(vectors);
+}
+
+void flow_free(AVR_Flow* flow) {
+
+	free_program(&flow->code);
+	free(flow->targets);
+	free(flow->unresolved);
+	free(flow->refs);
+	memset(flow, 0, sizeof *flow);
+}
+
+static size_t find_code(const AVR_Flow* flow, uint32_t addr) {
+
+	size_t lo = 0, hi = flow->code.count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (flow->code.instrs[mid].addr < addr) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+bool flow_is_code(const AVR_Flow* flow, uint32_t addr) {
+
+	size_t i = find_code(flow, addr);
+	return i < flow->code.count && flow->code.instrs[i].addr == addr;
+}
+
+static bool is_unresolved(const AVR_Flow* flow, uint32_t site) {
+
+	size_t lo = 0, hi = flow->nunresolved;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (flow->unresolved[mid] < site) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo < flow->nunresolved && flow->unresolved[lo] == site;
+}
+
+/* "-> 0x.. 0x.." for the targets of site, starting at targets[*t]. */
+static void format_targets(char* note, const AVR_Flow* flow, uint32_t site, size_t* t) {
+
+	int len = 0, shown = 0;
+
+	note[0] = '\0';
+	while (*t < flow->ntargets && flow->targets[*t].site < site) {
+		(*t)++;
+	}
+	for (; *t < flow->ntargets && flow->targets[*t].site == site; (*t)++) {
+		if (shown == 0) {
+			len += sprintf(note + len, "->");
+		}
+		if (shown++ < NOTE_TARGETS) {
+			len += sprintf(note + len, " 0x%04X", flow->targets[*t].target);
+		}
+	}
+	if (shown > NOTE_TARGETS) {
+		sprintf(note + len, " ... (%d)", shown);
+	}
+	if (shown == 0 && is_unresolved(flow, site)) {
+		sprintf(note, "unresolved");
+	}
+}
+
+/* A data region, ASCII_ROW characters or DB_ROW bytes per line. */
+static void print_region(const AVR_Image* img, const DataRegion* r) {
+
+	char	     line[DISASM_LINE_LEN];
+	AVR_Segment* seg  = image_find(img, r->addr);
+	int	     row  = r->kind == DATA_ASCII ? ASCII_ROW : DB_ROW;
+
+	for (uint32_t off = 0; off < r->len; off += row) {
+		const uint8_t* bytes = seg->data + (r->addr - seg->addr) + off;
+		size_t	       n     = r->len - off < (uint32_t) row ? r->len - off : (size_t) row;
+		if (r->kind == DATA_ASCII) format_ascii(line, r->addr + off, bytes, n);
+		else			   format_db_row(line, r->addr + off, bytes, n);
+		fputs(line, stdout);
+	}
+}
+
+/* Reached instructions disassembled, strings and LPM tables as .ascii
+   and .db, everything else as .dw. */
+int flow_listing(char* path, int format) {
+
+	AVR_Image   img;
+	AVR_Flow    flow;
+	DataRegion* regions;
+
+	load_avr_instructions();
+	image_init(&img);
+	load_image(path, format, &img);
+	flow_analyze(&img, &flow);
+	size_t nregions = data_regions(&img, &flow, &regions);
+
+	char   note[DISASM_LINE_LEN];
+	size_t i = 0, t = 0, r = 0;
+	size_t data = 0, text = 0;
+
+	for (int s = 0; s < img.count; s++) {
+
+		AVR_Segment* seg  = &img.segs[s];
+		size_t	     addr = seg->addr;
+		size_t	     end  = seg->addr + seg->len;
+
+		while (addr < end) {
+
+			while (i < flow.code.count && flow.code.instrs[i].addr < addr) {
+				i++;
+			}
+			if (i < flow.code.count && flow.code.instrs[i].addr == addr) {
+				const AVR_Decoded* d = &flow.code.instrs[i];
+				format_targets(note, &flow, d->addr, &t);
+				print_decoded_note(d, note[0] ? note : NULL);
+				addr += d->len;
+				continue;
+			}
+
+			while (r < nregions && regions[r].addr < addr) {
+				r++;
+			}
+			if (r < nregions && regions[r].addr == addr) {
+				print_region(&img, &regions[r]);
+				if (regions[r].kind == DATA_ASCII) text += regions[r].len;
+				else				   data += regions[r].len;
+				addr += regions[r].len;
+				continue;
+			}
+
+			/* Up to the next instruction or region, words where aligned. */
+			uint16_t word;
+			if (addr % 2 == 0 && addr + 1 < end && image_word(&img, addr, &word) &&
+			    !(i < flow.code.count && flow.code.instrs[i].addr == addr + 1) &&
+			    !(r < nregions && regions[r].addr == addr + 1)) {
+				print_dw(&addr, word);
+				data += 2;
+			}
+			else {
+				print_db(&addr, seg->data[addr - seg->addr]);
+				data += 1;
+			}
+		}
+	}
+
+	fprintf(stderr, "ihex2avr: %zu instructions reached, %zu data bytes, %zu text bytes, %zu indirect targets, %zu unresolved\n",
+		flow.code.count, data, text, flow.ntargets, flow.nunresolved);
+
+	free(regions);
+	flow_free(&flow);
+	image_free(&img);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "avr_image.h"
+#include "avr_decode.h"
+
+/* Recursive disassembly from the vector table, following branches, calls
+   and the IJMP/ICALL targets that Z-register tracking can resolve. */
+
+typedef struct IndirectTarget {
+
+	uint32_t site;	 // IJMP/ICALL/EIJMP/EICALL, or the JMP/CALL into a table-jump helper
+	uint32_t target;
+
+} IndirectTarget;
+
+typedef struct DataRef {
+
+	uint32_t addr;	// Z at an LPM/ELPM, or the base of an indexed read
+	uint32_t len;	// bytes covered by the index bound, 0 if unknown
+
+} DataRef;
+
+typedef struct AVR_Flow {
+
+	AVR_Program	code;	   // instructions reached, sorted by address
+	IndirectTarget* targets;   // sorted by site
+	size_t		ntargets;
+	uint32_t*	unresolved; // indirect sites with no known target
+	size_t		nunresolved;
+	DataRef*	refs;	   // sorted by address
+	size_t		nrefs;
+
+} AVR_Flow;
+
+void flow_analyze(const AVR_Image* img, AVR_Flow* flow);
+void flow_free(AVR_Flow* flow);
+bool flow_is_code(const AVR_Flow* flow, uint32_t addr);
+int  flow_listing(char* path, int format);
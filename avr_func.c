@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "avr_func.h"
+#include "avr_parse.h"
+
+#define IO_SPL 0x3d
+
+/* Every step is a pass over the program or the functions: starts are
+   marked in a table indexed by address instead of being sorted, and
+   callees are found through the same table. */
+
+static bool is_mnemonic(const AVR_Decoded* d, const char* mnemonic) {
+	return d->index != INSTR_NONE && !strcmp(AVR_INSTRUCTION_SET[d->index].mnemonic, mnemonic);
+}
+
+/* avr-gcc saves call-saved registers or sets up a frame pointer first. */
+static bool is_prologue(const AVR_Decoded* d) {
+
+	if (is_mnemonic(d, "PUSH")) {
+		int r = decoded_operand(d, 0);
+		return (r >= 2 && r <= 17) || r == 28 || r == 29;
+	}
+	return is_mnemonic(d, "IN") && decoded_operand(d, 0) == 28 && decoded_operand(d, 1) == IO_SPL;
+}
+
+/* Whether execution cannot fall from i - 1 into i. */
+static bool after_terminator(const AVR_Program* prog, size_t i) {
+
+	if (i == 0) {
+		return true;
+	}
+	const AVR_Decoded* d = &prog->instrs[i - 1];
+	if (d->index == INSTR_NONE || d->addr + d->len != prog->instrs[i].addr) {
+		return true;
+	}
+	int flow = AVR_INSTRUCTION_SET[d->index].flow;
+	return flow == FLOW_JUMP || flow == FLOW_IJUMP || flow == FLOW_RET;
+}
+
+static int64_t call_target(const AVR_Decoded* d) {
+
+	if (d->index == INSTR_NONE || AVR_INSTRUCTION_SET[d->index].flow != FLOW_CALL) {
+		return -1;
+	}
+	int64_t target = branch_target(d);
+	return target != d->addr + d->len ? target : -1; // RCALL .+0 reserves stack
+}
+
+void find_functions(const AVR_Program* prog, AVR_Functions* out) {
+
+	memset(out, 0, sizeof *out);
+	out->owner = xcalloc(prog->count + 1, sizeof(size_t));
+	if (prog->count == 0) {
+		out->funcs = xcalloc(1, sizeof(AVR_Function));
+		out->edges = xcalloc(1, sizeof(size_t));
+		return;
+	}
+
+	uint32_t  base = prog->instrs[0].addr;
+	uint32_t  span = prog->instrs[prog->count - 1].addr + prog->instrs[prog->count - 1].len - base;
+	uint32_t* at   = xcalloc((size_t) span + 1, sizeof(uint32_t)); // function index + 1 at each start
+
+	uint32_t* vectors;
+	size_t	  nvectors = program_vectors(prog, &vectors);
+	for (size_t v = 0; v < nvectors; v++) {
+		if (vectors[v] >= base && vectors[v] - base < span) at[vectors[v] - base] = 1;
+	}
+	for (size_t i = 0; i < prog->count; i++) {
+		int64_t target = call_target(&prog->instrs[i]);
+		if (target >= base && target - base < span) at[target - base] = 1;
+	}
+	free(vectors);
+
+	/* Starts in address order give the intervals; every instruction
+	   belongs to the last start at or before it. */
+	size_t cap = 64;
+	out->funcs = xcalloc(cap, sizeof(AVR_Function));
+	for (size_t i = 0; i < prog->count; i++) {
+
+		const AVR_Decoded* d = &prog->instrs[i];
+
+		if (d->index != INSTR_NONE && (at[d->addr - base] || (after_terminator(prog, i) && is_prologue(d)))) {
+			if (out->nfuncs == cap) {
+				cap *= 2;
+				out->funcs = xrealloc(out->funcs, cap * sizeof(AVR_Function));
+			}
+			AVR_Function* f = &out->funcs[out->nfuncs++];
+			memset(f, 0, sizeof *f);
+			f->addr = d->addr;
+			f->first = i;
+			at[d->addr - base] = (uint32_t) out->nfuncs;
+		}
+		else {
+			at[d->addr - base] = 0;
+		}
+
+		if (out->nfuncs == 0) {
+			out->owner[i] = SIZE_MAX;
+			continue;
+		}
+		AVR_Function* f = &out->funcs[out->nfuncs - 1];
+		out->owner[i] = out->nfuncs - 1;
+		f->count++;
+		f->size = d->addr + d->len - f->addr;
+		if (d->index != INSTR_NONE) f->instrs++;
+	}
+	for (size_t i = 0; i < prog->count; i++) {
+		if (out->owner[i] == SIZE_MAX) out->owner[i] = out->nfuncs;
+	}
+
+	/* Callee lists, deduplicated with the last caller seen per callee. */
+	size_t* seen = xcalloc(out->nfuncs + 1, sizeof(size_t));
+	size_t	ecap = 64;
+	out->edges = xcalloc(ecap, sizeof(size_t));
+	for (size_t fi = 0; fi < out->nfuncs; fi++) {
+
+		AVR_Function* f = &out->funcs[fi];
+		f->first_edge = out->nedges;
+
+		for (size_t i = f->first; i < f->first + f->count; i++) {
+			int64_t target = call_target(&prog->instrs[i]);
+			if (target < base || target - base >= span || at[target - base] == 0) {
+				continue;
+			}
+			size_t callee = at[target - base] - 1;
+			if (out->funcs[callee].addr != target || seen[callee] == fi + 1) { // a target inside an instruction
+				continue;
+			}
+			seen[callee] = fi + 1;
+			if (out->nedges == ecap) {
+				ecap *= 2;
+				out->edges = xrealloc(out->edges, ecap * sizeof(size_t));
+			}
+			out->edges[out->nedges++] = callee;
+			f->ncallees++;
+		}
+	}
+
+	free(seen);
+	free(at);
+}
+
+void free_functions(AVR_Functions* fns) {
+
+	free(fns->funcs);
+	free(fns->edges);
+	free(fns->owner);
+	memset(fns, 0, sizeof *fns);
+}
+
+/* The listing with a header before each function. */
+int function_listing(char* path, int format) {
+
+	AVR_Image     img;
+	AVR_Program   prog;
+	AVR_Functions fns;
+
+	load_avr_instructions();
+	image_init(&img);
+	load_image(path, format, &img);
+	decode_image(&img, &prog);
+	find_functions(&prog, &fns);
+
+	size_t next = 0;
+	for (size_t i = 0; i < prog.count; i++) {
+		if (next < fns.nfuncs && fns.funcs[next].first == i) {
+			AVR_Function* f = &fns.funcs[next++];
+			printf("\nsub_%04X: %u instructions, %u bytes", f->addr, f->instrs, f->size);
+			for (size_t e = 0; e < f->ncallees; e++) {
+				printf("%s sub_%04X", e ? "," : ", calls", fns.funcs[fns.edges[f->first_edge + e]].addr);
+			}
+			printf("\n");
+		}
+		print_decoded(&prog.instrs[i]);
+	}
+
+	free_functions(&fns);
+	free_program(&prog);
+	image_free(&img);
+	return EXIT_SUCCESS;
+}
+
+int parse_callgraph_format(const char* name) {
+
+	if (strcmp(name, "dot") == 0)  return CALLGRAPH_DOT;
+	if (strcmp(name, "json") == 0) return CALLGRAPH_JSON;
+	if (strcmp(name, "bin") == 0)  return CALLGRAPH_BIN;
+	return -1;
+}
+
+static void put_u32(uint8_t* p, uint32_t v) {
+
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = v >> 24;
+}
+
+static void write_dot(const AVR_Functions* fns) {
+
+	printf("digraph callgraph {\n");
+	for (size_t i = 0; i < fns->nfuncs; i++) {
+		const AVR_Function* f = &fns->funcs[i];
+		printf("\tsub_%04X [label=\"sub_%04X\\n%u instructions, %u bytes\"];\n", f->addr, f->addr, f->instrs, f->size);
+	}
+	for (size_t i = 0; i < fns->nfuncs; i++) {
+		const AVR_Function* f = &fns->funcs[i];
+		for (size_t e = 0; e < f->ncallees; e++) {
+			printf("\tsub_%04X -> sub_%04X;\n", f->addr, fns->funcs[fns->edges[f->first_edge + e]].addr);
+		}
+	}
+	printf("}\n");
+}
+
+static void write_json(const AVR_Functions* fns) {
+
+	printf("{\"functions\":[");
+	for (size_t i = 0; i < fns->nfuncs; i++) {
+		const AVR_Function* f = &fns->funcs[i];
+		printf("%s\n{\"name\":\"sub_%04X\",\"addr\":%u,\"size\":%u,\"instructions\":%u,\"callees\":[",
+		       i ? "," : "", f->addr, f->addr, f->size, f->instrs);
+		for (size_t e = 0; e < f->ncallees; e++) {
+			printf("%s%u", e ? "," : "", fns->funcs[fns->edges[f->first_edge + e]].addr);
+		}
+		printf("]}");
+	}
+	printf("\n]}\n");
+}
+
+static void write_bin(const AVR_Functions* fns) {
+
+	size_t	 size = 16 + fns->nfuncs * 20 + fns->nedges * 4;
+	uint8_t* buf  = xcalloc(size, 1);
+	uint8_t* p    = buf;
+
+	memcpy(p, CALLGRAPH_MAGIC, 8);
+	put_u32(p + 8, (uint32_t) fns->nfuncs);
+	put_u32(p + 12, (uint32_t) fns->nedges);
+	p += 16;
+	for (size_t i = 0; i < fns->nfuncs; i++, p += 20) {
+		const AVR_Function* f = &fns->funcs[i];
+		put_u32(p, f->addr);
+		put_u32(p + 4, f->size);
+		put_u32(p + 8, f->instrs);
+		put_u32(p + 12, (uint32_t) f->first_edge);
+		put_u32(p + 16, (uint32_t) f->ncallees);
+	}
+	for (size_t e = 0; e < fns->nedges; e++, p += 4) {
+		put_u32(p, (uint32_t) fns->edges[e]);
+	}
+	fwrite(buf, 1, size, stdout);
+	free(buf);
+}
+
+int callgraph_export(char* path, int format, int output) {
+
+	AVR_Image     img;
+	AVR_Program   prog;
+	AVR_Functions fns;
+
+	load_avr_instructions();
+	image_init(&img);
+	load_image(path, format, &img);
+	decode_image(&img, &prog);
+	find_functions(&prog, &fns);
+
+	switch (output) {
+		case CALLGRAPH_DOT:  write_dot(&fns);  break;
+		case CALLGRAPH_JSON: write_json(&fns); break;
+		case CALLGRAPH_BIN:  write_bin(&fns);  break;
+	}
+
+	free_functions(&fns);
+	free_program(&prog);
+	image_free(&img);
+	return EXIT_SUCCESS;
+}
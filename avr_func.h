@@ -0,0 +1,47 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "avr_decode.h"
+
+/* Functions of a linear listing: every call target, vector entry and
+   prologue after a terminator starts one, and each runs up to the next
+   start. */
+
+#define CALLGRAPH_DOT  0
+#define CALLGRAPH_JSON 1
+#define CALLGRAPH_BIN  2
+
+/* Binary call graph, little-endian:
+	char     magic[8]    "AVRCG1\0\0"
+	uint32_t nfuncs, nedges
+	nfuncs x { uint32_t addr, size, instrs, first_edge, ncallees }
+	nedges x uint32_t callee function index */
+#define CALLGRAPH_MAGIC "AVRCG1\0"
+
+typedef struct AVR_Function {
+
+	uint32_t addr;
+	uint32_t size;	   // bytes up to the end of its last instruction
+	uint32_t instrs;   // decoded instructions, .dw words excluded
+	size_t	 first;	   // first instruction in the program
+	size_t	 count;	   // instructions in the program, .dw words included
+	size_t	 first_edge;
+	size_t	 ncallees;
+
+} AVR_Function;
+
+typedef struct AVR_Functions {
+
+	AVR_Function* funcs;	// sorted by address
+	size_t	      nfuncs;
+	size_t*	      edges;	// callee indices, ncallees per function from first_edge
+	size_t	      nedges;
+	size_t*	      owner;	// per instruction, nfuncs before the first function
+
+} AVR_Functions;
+
+void find_functions(const AVR_Program* prog, AVR_Functions* out);
+void free_functions(AVR_Functions* fns);
+int  function_listing(char* path, int format);
+int  callgraph_export(char* path, int format, int output);
+int  parse_callgraph_format(const char* name);
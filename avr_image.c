@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avr_image.h"
+
+void* xrealloc(void* ptr, size_t size) {
+
+	void* p = realloc(ptr, size);
+	if (p == NULL) {
+		fprintf(stderr, "ihex2avr: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+void* xcalloc(size_t n, size_t size) {
+
+	void* p = calloc(n ? n : 1, size);
+	if (p == NULL) {
+		fprintf(stderr, "ihex2avr: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+static void seg_reserve(AVR_Segment* seg, uint32_t len) {
+
+	if (len <= seg->cap) {
+		return;
+	}
+
+	uint32_t cap = seg->cap ? seg->cap : 256;
+	while (cap < len) {
+		cap *= 2;
+	}
+	seg->data = xrealloc(seg->data, cap);
+	seg->cap  = cap;
+}
+
+/* Index of the first segment ending at or after addr. */
+static int lower_bound(const AVR_Image* img, uint32_t addr) {
+
+	int lo = 0;
+	int hi = img->count;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if ((uint64_t) img->segs[mid].addr + img->segs[mid].len < addr) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+void image_init(AVR_Image* img) {
+	img->segs  = NULL;
+	img->count = 0;
+	img->cap   = 0;
+}
+
+void image_free(AVR_Image* img) {
+
+	for (int i = 0; i < img->count; i++) {
+		free(img->segs[i].data);
+	}
+	free(img->segs);
+	image_init(img);
+}
+
+void image_write(AVR_Image* img, uint32_t addr, const uint8_t* data, uint32_t len) {
+
+	if (len == 0) {
+		return;
+	}
+
+	uint64_t end = (uint64_t) addr + len;
+	int i = lower_bound(img, addr);
+
+	if (i == img->count || img->segs[i].addr > end) {
+
+		if (img->count == img->cap) {
+			img->cap  = img->cap ? img->cap * 2 : 16;
+			img->segs = xrealloc(img->segs, img->cap * sizeof(AVR_Segment));
+		}
+		memmove(&img->segs[i + 1], &img->segs[i], (img->count - i) * sizeof(AVR_Segment));
+		img->count++;
+
+		AVR_Segment* seg = &img->segs[i];
+		seg->addr = addr;
+		seg->len  = 0;
+		seg->cap  = 0;
+		seg->data = NULL;
+	}
+
+	// Segment i touches [addr, end), grow it to cover the union and
+	// swallow every following segment the new range reaches.
+	AVR_Segment* seg = &img->segs[i];
+	if (addr < seg->addr) {
+
+		uint32_t shift = seg->addr - addr;
+		seg_reserve(seg, seg->len + shift);
+		memmove(seg->data + shift, seg->data, seg->len);
+		seg->addr = addr;
+		seg->len += shift;
+	}
+
+	int last = i;
+	while (last + 1 < img->count && img->segs[last + 1].addr <= end) {
+		last++;
+	}
+
+	uint64_t seg_end = (uint64_t) img->segs[last].addr + img->segs[last].len;
+	if (seg_end < end) seg_end = end;
+	if ((uint64_t) seg->addr + seg->len > seg_end) seg_end = (uint64_t) seg->addr + seg->len;
+
+	seg_reserve(seg, (uint32_t) (seg_end - seg->addr));
+	for (int j = i + 1; j <= last; j++) {
+		AVR_Segment* next = &img->segs[j];
+		memcpy(seg->data + (next->addr - seg->addr), next->data, next->len);
+		free(next->data);
+	}
+	if (last > i) {
+		memmove(&img->segs[i + 1], &img->segs[last + 1], (img->count - last - 1) * sizeof(AVR_Segment));
+		img->count -= last - i;
+	}
+
+	memcpy(seg->data + (addr - seg->addr), data, len);
+	seg->len = (uint32_t) (seg_end - seg->addr);
+}
+
+AVR_Segment* image_find(const AVR_Image* img, uint32_t addr) {
+
+	int lo = 0;
+	int hi = img->count;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		AVR_Segment* seg = &img->segs[mid];
+		if (addr < seg->addr) hi = mid;
+		else if (addr >= seg->addr + seg->len) lo = mid + 1;
+		else return seg;
+	}
+	return NULL;
+}
+
+bool image_read(const AVR_Image* img, uint32_t addr, uint8_t* byte) {
+
+	AVR_Segment* seg = image_find(img, addr);
+	if (seg == NULL) {
+		return false;
+	}
+	*byte = seg->data[addr - seg->addr];
+	return true;
+}
+
+bool image_word(const AVR_Image* img, uint32_t addr, uint16_t* word) {
+
+	uint8_t lsb, msb;
+	if (!image_read(img, addr, &lsb) || !image_read(img, addr + 1, &msb)) {
+		return false;
+	}
+	*word = (msb << 8) | lsb;
+	return true;
+}
+
+uint32_t image_size(const AVR_Image* img) {
+
+	uint32_t size = 0;
+	for (int i = 0; i < img->count; i++) {
+		size += img->segs[i].len;
+	}
+	return size;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Sparse memory model: sorted, non-overlapping runs of bytes as they
+   appear in flash (little-endian words). Adjacent writes are coalesced. */
+
+typedef struct AVR_Segment {
+
+	uint32_t addr;
+	uint32_t len;
+	uint32_t cap;
+	uint8_t* data;
+
+} AVR_Segment;
+
+typedef struct AVR_Image {
+
+	AVR_Segment* segs;
+	int count;
+	int cap;
+
+} AVR_Image;
+
+void* xrealloc(void* ptr, size_t size);
+void* xcalloc(size_t n, size_t size);
+
+void image_init(AVR_Image* img);
+void image_free(AVR_Image* img);
+void image_write(AVR_Image* img, uint32_t addr, const uint8_t* data, uint32_t len);
+
+AVR_Segment* image_find(const AVR_Image* img, uint32_t addr);
+bool image_read(const AVR_Image* img, uint32_t addr, uint8_t* byte);
+bool image_word(const AVR_Image* img, uint32_t addr, uint16_t* word);
+uint32_t image_size(const AVR_Image* img);
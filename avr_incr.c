@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "avr_incr.h"
+#include "avr_parse.h"
+#include "avr_decode.h"
+#include "avr_disasm.h"
+
+#define BLOCK_MAGIC "AVRBLK1"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+typedef struct BlockHeader {
+
+	char	 magic[8];
+	uint64_t table;
+	uint64_t listing_size;
+	uint32_t count;
+	uint32_t reserved;
+
+} BlockHeader;
+
+typedef struct BlockEntry {
+
+	uint32_t addr;
+	uint32_t len;
+	uint64_t hash;
+	uint64_t offset; // of its first line in the listing
+	uint32_t text_len;
+	uint32_t skew;	 // bytes the last instruction runs into the next piece
+
+} BlockEntry;
+
+static uint64_t fnv(uint64_t hash, const uint8_t* data, size_t len) {
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= data[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+static char* sidecar_path(const char* output, const char* suffix) {
+
+	char* path = xcalloc(strlen(output) + strlen(suffix) + 1, 1);
+	strcpy(path, output);
+	strcat(path, suffix);
+	return path;
+}
+
+/* Previous entries, or NULL when there are none or they do not describe
+   the listing now in output. */
+static BlockEntry* read_blocks(char* blocks_path, char* output, size_t* count, uint8_t** listing, size_t* listing_size) {
+
+	FILE* fp = fopen(blocks_path, "rb");
+	if (fp == NULL) {
+		return NULL;
+	}
+	FILE* out = fopen(output, "rb");
+	if (out == NULL) {
+		fclose(fp);
+		return NULL;
+	}
+	fclose(out);
+
+	BlockHeader header;
+	BlockEntry* entries = NULL;
+
+	if (fread(&header, sizeof header, 1, fp) == 1 && !memcmp(header.magic, BLOCK_MAGIC, sizeof header.magic) &&
+	    header.table == instr_table_version()) {
+
+		entries = xcalloc(header.count + 1, sizeof(BlockEntry));
+		if (fread(entries, sizeof(BlockEntry), header.count, fp) != header.count) {
+			free(entries);
+			entries = NULL;
+		}
+		*count = header.count;
+	}
+	fclose(fp);
+
+	if (entries != NULL) {
+		*listing = map_file(output, listing_size);
+		if (*listing_size != header.listing_size) {
+			unmap_file(*listing, *listing_size);
+			*listing = NULL;
+			free(entries);
+			entries = NULL;
+		}
+	}
+	return entries;
+}
+
+static const BlockEntry* find_block(const BlockEntry* entries, size_t count, uint32_t addr) {
+
+	size_t lo = 0;
+	size_t hi = count;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (entries[mid].addr < addr) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo < count && entries[lo].addr == addr ? &entries[lo] : NULL;
+}
+
+int render_incremental(const AVR_Image* img, char* output, IncrementalStats* stats) {
+
+	char* blocks_path = sidecar_path(output, ".blocks");
+	char* tmp_path	  = sidecar_path(output, ".tmp");
+
+	size_t	    nold = 0, listing_size = 0;
+	uint8_t*    listing = NULL;
+	BlockEntry* old	    = read_blocks(blocks_path, output, &nold, &listing, &listing_size);
+
+	FILE* fp = fopen(tmp_path, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "ihex2avr: could not write %s\n", tmp_path);
+		exit(EXIT_FAILURE);
+	}
+
+	size_t	    nblocks = 0, cap = 0;
+	BlockEntry* blocks  = NULL;
+	uint64_t    offset  = 0;
+	AVR_Decoded decoded[BLOCK_SIZE / 2 + 1];
+	char	    line[DISASM_LINE_LEN];
+
+	stats->blocks	= 0;
+	stats->rendered = 0;
+
+	for (int s = 0; s < img->count; s++) {
+
+		const AVR_Segment* seg	= &img->segs[s];
+		uint32_t	   end	= seg->addr + seg->len;
+		uint32_t	   skew = 0;
+
+		for (uint32_t lo = seg->addr; lo < end; lo = (lo & ~(BLOCK_SIZE - 1)) + BLOCK_SIZE) {
+
+			uint32_t hi    = (lo & ~(BLOCK_SIZE - 1)) + BLOCK_SIZE < end ? (lo & ~(BLOCK_SIZE - 1)) + BLOCK_SIZE : end;
+			uint32_t ahead = end - hi < 2 ? end - hi : 2;
+			uint32_t key[4] = { lo, hi - lo, skew, ahead };
+
+			if (nblocks == cap) {
+				cap    = cap ? cap * 2 : 256;
+				blocks = xrealloc(blocks, cap * sizeof(BlockEntry));
+			}
+			BlockEntry* b = &blocks[nblocks++];
+			b->addr	      = lo;
+			b->len	      = hi - lo;
+			b->hash	      = fnv(fnv(FNV_OFFSET, (const uint8_t*) key, sizeof key), seg->data + (lo - seg->addr), hi - lo + ahead);
+			b->offset     = offset;
+
+			const BlockEntry* prev = old ? find_block(old, nold, lo) : NULL;
+			if (prev != NULL && prev->hash == b->hash && prev->len == b->len &&
+			    prev->offset + prev->text_len <= listing_size) {
+				fwrite(listing + prev->offset, 1, prev->text_len, fp);
+				b->text_len = prev->text_len;
+				b->skew	    = prev->skew;
+			}
+			else {
+				size_t	 n    = decode_range(img, lo + skew, hi, decoded);
+				uint32_t next = lo + skew;
+				b->text_len   = 0;
+				for (size_t i = 0; i < n; i++) {
+					int len = format_decoded(line, &decoded[i], NULL);
+					fwrite(line, 1, len, fp);
+					b->text_len += len;
+					next	     = decoded[i].addr + decoded[i].len;
+				}
+				b->skew = next > hi ? next - hi : 0;
+				stats->rendered++;
+			}
+			offset += b->text_len;
+			skew	= b->skew;
+		}
+	}
+	stats->blocks = nblocks;
+
+	if (fclose(fp) != 0 || rename(tmp_path, output) != 0) {
+		fprintf(stderr, "ihex2avr: could not write %s\n", output);
+		exit(EXIT_FAILURE);
+	}
+
+	BlockHeader header;
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, BLOCK_MAGIC, sizeof header.magic);
+	header.table	    = instr_table_version();
+	header.listing_size = offset;
+	header.count	    = (uint32_t) nblocks;
+
+	fp = fopen(blocks_path, "wb");
+	if (fp == NULL || fwrite(&header, sizeof header, 1, fp) != 1 || fwrite(blocks, sizeof(BlockEntry), nblocks, fp) != nblocks) {
+		fprintf(stderr, "ihex2avr: could not write %s\n", blocks_path);
+	}
+	if (fp != NULL) {
+		fclose(fp);
+	}
+
+	if (listing != NULL) {
+		unmap_file(listing, listing_size);
+	}
+	free(old);
+	free(blocks);
+	free(blocks_path);
+	free(tmp_path);
+	return EXIT_SUCCESS;
+}
+
+int incremental_listing(char* path, int format, char* output) {
+
+	load_avr_instructions();
+
+	AVR_Image	 img;
+	IncrementalStats stats;
+	image_init(&img);
+	load_image(path, format, &img);
+
+	int status = render_incremental(&img, output, &stats);
+	fprintf(stderr, "ihex2avr: %zu of %zu blocks rendered\n", stats.rendered, stats.blocks);
+
+	image_free(&img);
+	return status;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "avr_image.h"
+
+/* Sidecar "<output>.blocks": a header with the instruction table version
+   and the listing size, then one entry per BLOCK_SIZE aligned piece of a
+   segment with the hash of its bytes and where its lines are in the
+   listing, sorted by address. The hash covers the offset of the first
+   instruction in the piece and the two bytes after it, so a 32-bit
+   instruction straddling into or out of a changed piece re-renders it
+   as well. */
+
+#define BLOCK_SIZE 256
+
+typedef struct IncrementalStats {
+
+	size_t blocks;
+	size_t rendered;
+
+} IncrementalStats;
+
+/* Writes the listing of img to output, reusing the lines of unchanged
+   blocks from the previous run. */
+int render_incremental(const AVR_Image* img, char* output, IncrementalStats* stats);
+int incremental_listing(char* path, int format, char* output);
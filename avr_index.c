@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "avr_index.h"
+#include "avr_parse.h"
+#include "avr_decode.h"
+
+#define INDEX_MAGIC   "AVRIDX1"
+#define INDEX_CONTEXT 32 // bytes decoded ahead of the range to align instructions
+
+typedef struct IndexHeader {
+
+	char	 magic[8];
+	uint64_t size;
+	int64_t  mtime;
+	uint32_t format;
+	uint32_t count;
+
+} IndexHeader;
+
+static int cmp_addr(const void* a, const void* b) {
+
+	const HexRecord* ra = a;
+	const HexRecord* rb = b;
+	if (ra->addr != rb->addr) {
+		return (ra->addr > rb->addr) - (ra->addr < rb->addr);
+	}
+	return (ra->offset > rb->offset) - (ra->offset < rb->offset);
+}
+
+static int cmp_offset(const void* a, const void* b) {
+
+	const HexRecord* ra = a;
+	const HexRecord* rb = b;
+	return (ra->offset > rb->offset) - (ra->offset < rb->offset);
+}
+
+static HexRecord* read_index(char* idx_path, const IndexHeader* expect, size_t* count) {
+
+	FILE* fp = fopen(idx_path, "rb");
+	if (fp == NULL) {
+		return NULL;
+	}
+
+	IndexHeader header;
+	HexRecord*  recs = NULL;
+
+	if (fread(&header, sizeof header, 1, fp) == 1 &&
+	    !memcmp(header.magic, expect->magic, sizeof header.magic) &&
+	    header.size == expect->size && header.mtime == expect->mtime && header.format == expect->format) {
+
+		recs = xcalloc(header.count, sizeof(HexRecord));
+		if (fread(recs, sizeof(HexRecord), header.count, fp) != header.count) {
+			free(recs);
+			recs = NULL;
+		}
+		*count = header.count;
+	}
+	fclose(fp);
+	return recs;
+}
+
+static void write_index(char* idx_path, IndexHeader* header, const HexRecord* recs, size_t count) {
+
+	FILE* fp = fopen(idx_path, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "ihex2avr: could not write %s\n", idx_path);
+		return;
+	}
+
+	header->count = (uint32_t) count;
+	if (fwrite(header, sizeof *header, 1, fp) != 1 || fwrite(recs, sizeof(HexRecord), count, fp) != count) {
+		fprintf(stderr, "ihex2avr: could not write %s\n", idx_path);
+	}
+	fclose(fp);
+}
+
+static HexRecord* load_index(char* path, int format, size_t* count) {
+
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		fprintf(stderr, "ihex2avr: could not open %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	IndexHeader header;
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, INDEX_MAGIC, sizeof header.magic);
+	header.size   = st.st_size;
+	header.mtime  = st.st_mtime;
+	header.format = format;
+
+	char* idx_path = xcalloc(strlen(path) + 5, 1);
+	strcpy(idx_path, path);
+	strcat(idx_path, ".idx");
+
+	HexRecord* recs = read_index(idx_path, &header, count);
+	if (recs == NULL) {
+		*count = scan_records(path, format, &recs);
+		qsort(recs, *count, sizeof(HexRecord), cmp_addr);
+		write_index(idx_path, &header, recs, *count);
+	}
+
+	free(idx_path);
+	return recs;
+}
+
+/* Records overlapping [lo, hi), back in file order so later records
+   still overwrite earlier ones. */
+static HexRecord* select_records(const HexRecord* recs, size_t count, uint32_t lo, uint32_t hi, size_t* selected) {
+
+	uint32_t first = lo > 0xff ? lo - 0xff : 0;
+	size_t   l = 0;
+	size_t   h = count;
+	while (l < h) {
+		size_t mid = (l + h) / 2;
+		if (recs[mid].addr < first) l = mid + 1;
+		else h = mid;
+	}
+
+	HexRecord* out = xcalloc(count - l, sizeof(HexRecord));
+	*selected = 0;
+	for (size_t i = l; i < count && recs[i].addr < hi; i++) {
+		if (recs[i].addr + recs[i].len > lo) {
+			out[(*selected)++] = recs[i];
+		}
+	}
+
+	qsort(out, *selected, sizeof(HexRecord), cmp_offset);
+	return out;
+}
+
+int disasm_range(char* path, int format, uint32_t start, uint32_t end, bool indexed, bool ordered) {
+
+	load_avr_instructions();
+
+	AVR_Image   img;
+	AVR_Program prog;
+	image_init(&img);
+
+	if (indexed) {
+
+		size_t count, selected;
+		HexRecord* recs = load_index(path, format, &count);
+		HexRecord* sel  = select_records(recs, count,
+			start > INDEX_CONTEXT ? start - INDEX_CONTEXT : 0, end, &selected);
+
+		load_records(path, format, &img, sel, selected);
+		free(sel);
+		free(recs);
+	}
+	else {
+		load_range(path, format, &img, start > INDEX_CONTEXT ? start - INDEX_CONTEXT : 0, end, ordered);
+	}
+
+	decode_image(&img, &prog);
+
+	size_t i = program_find(&prog, start);
+	if (i == prog.count) {
+		i = 0;
+	}
+	for (; i < prog.count && prog.instrs[i].addr < end; i++) {
+		if (prog.instrs[i].addr >= start) {
+			print_decoded(&prog.instrs[i]);
+		}
+	}
+
+	free_program(&prog);
+	image_free(&img);
+	return EXIT_SUCCESS;
+}
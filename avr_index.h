@@ -0,0 +1,9 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Sidecar index "<file>.idx": a header identifying the input by size and
+   modification time followed by every data record's file offset and
+   address range, sorted by address. */
+
+int disasm_range(char* path, int format, uint32_t start, uint32_t end, bool indexed, bool ordered);
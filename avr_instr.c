@@ -6,6 +6,8 @@
 #include "avr_instr.h"
 
 AVR_Instr AVR_INSTRUCTION_SET[INSTRUCTIONS];
+uint8_t   AVR_DECODE_TABLE[1 << OPCODE_LEN];
+
 static const char* pointer_regs[] = {
 		"X", "Y", "Z",
 		"-X", "-Y", "-Z",
@@ -34,6 +36,141 @@ static bool is_gpr(char* reg) {
 	       !strcmp(reg, "Rd");
 }
 
+static int get_flow(char* mnemonic) {
+
+	if (!strcmp(mnemonic, "RJMP")  || !strcmp(mnemonic, "JMP"))    return FLOW_JUMP;
+	if (!strcmp(mnemonic, "RCALL") || !strcmp(mnemonic, "CALL"))   return FLOW_CALL;
+	if (!strcmp(mnemonic, "IJMP")  || !strcmp(mnemonic, "EIJMP"))  return FLOW_IJUMP;
+	if (!strcmp(mnemonic, "ICALL") || !strcmp(mnemonic, "EICALL")) return FLOW_ICALL;
+	if (!strcmp(mnemonic, "RET")   || !strcmp(mnemonic, "RETI"))   return FLOW_RET;
+
+	if (!strcmp(mnemonic, "CPSE") ||
+	    !strcmp(mnemonic, "SBRC") || !strcmp(mnemonic, "SBRS") ||
+	    !strcmp(mnemonic, "SBIC") || !strcmp(mnemonic, "SBIS")) {
+		return FLOW_SKIP;
+	}
+
+	return strncmp(mnemonic, "BR", 2) || !strcmp(mnemonic, "BREAK") ? FLOW_NONE : FLOW_BRANCH;
+}
+
+typedef struct Effects {
+
+	const char* mnemonic;
+	uint8_t	    operand_use;
+	uint8_t	    operand_def;
+	uint8_t	    sreg_use;
+	uint8_t	    sreg_def;
+	uint32_t    reg_use;
+	uint32_t    reg_def;
+
+} Effects;
+
+#define ARITH (FLAG_H | FLAG_S | FLAG_V | FLAG_N | FLAG_Z | FLAG_C)
+#define LOGIC (FLAG_S | FLAG_V | FLAG_N | FLAG_Z)
+#define SHIFT (FLAG_S | FLAG_V | FLAG_N | FLAG_Z | FLAG_C)
+#define Z_REG REG_PAIR(30)
+
+/* Mnemonics not listed (jumps, calls, skips on I/O bits, NOP, ...) touch
+   no registers besides their pointer operands. */
+static const Effects EFFECTS[] = {
+	/* mnemonic  opnd use/def  sreg use         sreg def          regs use          regs def */
+	{ "ADD",     0x3, 0x1,     0,               ARITH,            0,                0               },
+	{ "ADC",     0x3, 0x1,     FLAG_C,          ARITH,            0,                0               },
+	{ "ADIW",    0x1, 0x1,     0,               SHIFT,            0,                0               },
+	{ "SUB",     0x3, 0x1,     0,               ARITH,            0,                0               },
+	{ "SUBI",    0x1, 0x1,     0,               ARITH,            0,                0               },
+	{ "SBC",     0x3, 0x1,     FLAG_C | FLAG_Z, ARITH,            0,                0               },
+	{ "SBCI",    0x1, 0x1,     FLAG_C | FLAG_Z, ARITH,            0,                0               },
+	{ "SBIW",    0x1, 0x1,     0,               SHIFT,            0,                0               },
+	{ "AND",     0x3, 0x1,     0,               LOGIC,            0,                0               },
+	{ "ANDI",    0x1, 0x1,     0,               LOGIC,            0,                0               },
+	{ "OR",      0x3, 0x1,     0,               LOGIC,            0,                0               },
+	{ "ORI",     0x1, 0x1,     0,               LOGIC,            0,                0               },
+	{ "EOR",     0x3, 0x1,     0,               LOGIC,            0,                0               },
+	{ "COM",     0x1, 0x1,     0,               SHIFT,            0,                0               },
+	{ "NEG",     0x1, 0x1,     0,               ARITH,            0,                0               },
+	{ "SBR",     0x1, 0x1,     0,               LOGIC,            0,                0               },
+	{ "CBR",     0x1, 0x1,     0,               LOGIC,            0,                0               },
+	{ "INC",     0x1, 0x1,     0,               LOGIC,            0,                0               },
+	{ "DEC",     0x1, 0x1,     0,               LOGIC,            0,                0               },
+	{ "TST",     0x1, 0x0,     0,               LOGIC,            0,                0               },
+	{ "CLR",     0x0, 0x1,     0,               LOGIC,            0,                0               },
+	{ "SER",     0x0, 0x1,     0,               0,                0,                0               },
+	{ "MUL",     0x3, 0x0,     0,               FLAG_Z | FLAG_C,  0,                REG_PAIR(0)     },
+	{ "MULS",    0x3, 0x0,     0,               FLAG_Z | FLAG_C,  0,                REG_PAIR(0)     },
+	{ "MULSU",   0x3, 0x0,     0,               FLAG_Z | FLAG_C,  0,                REG_PAIR(0)     },
+	{ "FMUL",    0x3, 0x0,     0,               FLAG_Z | FLAG_C,  0,                REG_PAIR(0)     },
+	{ "FMULS",   0x3, 0x0,     0,               FLAG_Z | FLAG_C,  0,                REG_PAIR(0)     },
+	{ "FMULSU",  0x3, 0x0,     0,               FLAG_Z | FLAG_C,  0,                REG_PAIR(0)     },
+	{ "DES",     0x0, 0x0,     FLAG_H,          0,                0xffff,           0xffff          },
+	{ "IJMP",    0x0, 0x0,     0,               0,                Z_REG,            0               },
+	{ "EIJMP",   0x0, 0x0,     0,               0,                Z_REG,            0               },
+	{ "ICALL",   0x0, 0x0,     0,               0,                Z_REG,            0               },
+	{ "EICALL",  0x0, 0x0,     0,               0,                Z_REG,            0               },
+	{ "RETI",    0x0, 0x0,     0,               FLAG_I,           0,                0               },
+	{ "CPSE",    0x3, 0x0,     0,               0,                0,                0               },
+	{ "CP",      0x3, 0x0,     0,               ARITH,            0,                0               },
+	{ "CPC",     0x3, 0x0,     FLAG_C | FLAG_Z, ARITH,            0,                0               },
+	{ "CPI",     0x1, 0x0,     0,               ARITH,            0,                0               },
+	{ "SBRC",    0x1, 0x0,     0,               0,                0,                0               },
+	{ "SBRS",    0x1, 0x0,     0,               0,                0,                0               },
+	{ "MOV",     0x2, 0x1,     0,               0,                0,                0               },
+	{ "MOVW",    0x2, 0x1,     0,               0,                0,                0               },
+	{ "LDI",     0x0, 0x1,     0,               0,                0,                0               },
+	{ "LDS",     0x0, 0x1,     0,               0,                0,                0               },
+	{ "LD",      0x0, 0x1,     0,               0,                0,                0               },
+	{ "LDD",     0x0, 0x1,     0,               0,                0,                0               },
+	{ "STS",     0x2, 0x0,     0,               0,                0,                0               },
+	{ "ST",      0x2, 0x0,     0,               0,                0,                0               },
+	{ "STD",     0x2, 0x0,     0,               0,                0,                0               },
+	{ "LPM",     0x0, 0x1,     0,               0,                0,                0               },
+	{ "ELPM",    0x0, 0x1,     0,               0,                0,                0               },
+	{ "SPM",     0x0, 0x0,     0,               0,                REG_PAIR(0) | Z_REG, 0            },
+	{ "ESPM",    0x0, 0x0,     0,               0,                REG_PAIR(0) | Z_REG, 0            },
+	{ "IN",      0x0, 0x1,     0,               0,                0,                0               },
+	{ "OUT",     0x2, 0x0,     0,               0,                0,                0               },
+	{ "PUSH",    0x1, 0x0,     0,               0,                0,                0               },
+	{ "POP",     0x0, 0x1,     0,               0,                0,                0               },
+	{ "XCH",     0x2, 0x2,     0,               0,                0,                0               },
+	{ "LAS",     0x2, 0x2,     0,               0,                0,                0               },
+	{ "LAC",     0x2, 0x2,     0,               0,                0,                0               },
+	{ "LAT",     0x2, 0x2,     0,               0,                0,                0               },
+	{ "LSL",     0x1, 0x1,     0,               ARITH,            0,                0               },
+	{ "LSR",     0x1, 0x1,     0,               SHIFT,            0,                0               },
+	{ "ROL",     0x1, 0x1,     FLAG_C,          ARITH,            0,                0               },
+	{ "ROR",     0x1, 0x1,     FLAG_C,          SHIFT,            0,                0               },
+	{ "ASR",     0x1, 0x1,     0,               SHIFT,            0,                0               },
+	{ "SWAP",    0x1, 0x1,     0,               0,                0,                0               },
+	{ "BST",     0x1, 0x0,     0,               FLAG_T,           0,                0               },
+	{ "BLD",     0x1, 0x1,     FLAG_T,          0,                0,                0               }
+};
+
+static void set_effects(AVR_Instr* instr) {
+
+	instr->operand_use = instr->operand_def = 0;
+	instr->sreg_use	   = instr->sreg_def	= 0;
+	instr->reg_use	   = instr->reg_def	= 0;
+
+	for (size_t i = 0; i < sizeof EFFECTS / sizeof EFFECTS[0]; i++) {
+		if (!strcmp(EFFECTS[i].mnemonic, instr->mnemonic)) {
+			instr->operand_use = EFFECTS[i].operand_use;
+			instr->operand_def = EFFECTS[i].operand_def;
+			instr->sreg_use	   = EFFECTS[i].sreg_use;
+			instr->sreg_def	   = EFFECTS[i].sreg_def;
+			instr->reg_use	   = EFFECTS[i].reg_use;
+			instr->reg_def	   = EFFECTS[i].reg_def;
+			break;
+		}
+	}
+
+	/* LPM and ELPM without operands load r0 from Z. */
+	if (instr->argc == 0 && (!strcmp(instr->mnemonic, "LPM") || !strcmp(instr->mnemonic, "ELPM"))) {
+		instr->operand_def = 0;
+		instr->reg_use	   = Z_REG;
+		instr->reg_def	   = REG(0);
+	}
+}
+
 static uint16_t get_opcode_mask(char* opcode) {
 
 	uint16_t mask = 0x0;
@@ -151,6 +288,7 @@ int parse_avr_instructions(char* f) {
 		get_operand_masks(opcode, operands, len, argc, operand_masks);
 
 		AVR_Instr avr_instr;
+		memset(&avr_instr, 0, sizeof avr_instr); // the version hash covers the padding after each NUL
 
 		strcpy(avr_instr.mnemonic, mnemonic);
 		strcpy(avr_instr.operand_types, operand_types);
@@ -159,6 +297,8 @@ int parse_avr_instructions(char* f) {
 
 		avr_instr.len  = len;
 		avr_instr.argc = argc;
+		avr_instr.flow = get_flow(mnemonic);
+		set_effects(&avr_instr);
 		avr_instr.opcode_bits = opcode_bits;
 		avr_instr.opcode_mask = opcode_mask;
 
@@ -180,3 +320,78 @@ int parse_avr_instructions(char* f) {
 	fclose(fp);
 	return EXIT_SUCCESS;
 }
+
+/* Loads avr.txt once and fills AVR_DECODE_TABLE, which maps every
+   16-bit word to the first matching AVR_INSTRUCTION_SET entry. */
+void load_avr_instructions(void) {
+
+	static bool loaded = false;
+	if (loaded) {
+		return;
+	}
+
+	if (parse_avr_instructions("avr.txt")) {
+		fprintf(stderr, "ihex2avr: failed to parse instructions\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (uint32_t word = 0; word < (1 << OPCODE_LEN); word++) {
+		AVR_DECODE_TABLE[word] = INSTR_NONE;
+		for (int j = 0; j < INSTRUCTIONS; j++) {
+			if ((word & AVR_INSTRUCTION_SET[j].opcode_mask) == AVR_INSTRUCTION_SET[j].opcode_bits) {
+				AVR_DECODE_TABLE[word] = j;
+				break;
+			}
+		}
+	}
+	loaded = true;
+}
+
+#ifdef _DEBUG
+/* every byte of the string fields is hashed, including those after the NUL */
+static bool zero_padded(const char* str, size_t size) {
+
+	const char* end = memchr(str, 0, size);
+	for (; end && end < str + size; end++) {
+		if (*end) return false;
+	}
+	return true;
+}
+#endif
+
+/* FNV-1a over everything in the loaded table that shows in a listing,
+   so results cached on disk are dropped when avr.txt changes. */
+uint64_t instr_table_version(void) {
+
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (int i = 0; i < INSTRUCTIONS; i++) {
+
+		const AVR_Instr* instr = &AVR_INSTRUCTION_SET[i];
+		uint8_t fields[sizeof instr->mnemonic + sizeof instr->operand_types + sizeof instr->operands + 6];
+		memcpy(fields, instr->mnemonic, sizeof instr->mnemonic);
+		memcpy(fields + sizeof instr->mnemonic, instr->operand_types, sizeof instr->operand_types);
+		memcpy(fields + sizeof instr->mnemonic + sizeof instr->operand_types, instr->operands, sizeof instr->operands);
+
+#ifdef _DEBUG
+		if (!zero_padded(instr->mnemonic, sizeof instr->mnemonic) || !zero_padded(instr->operand_types, sizeof instr->operand_types) ||
+		    !zero_padded(instr->operands[0], sizeof instr->operands[0]) || !zero_padded(instr->operands[1], sizeof instr->operands[1])) {
+			fprintf(stderr, "ihex2avr: %s is not zero padded, the table version is unstable\n", instr->mnemonic);
+			abort();
+		}
+#endif
+
+		uint8_t* tail = fields + sizeof fields - 6;
+		tail[0] = (uint8_t) instr->len;
+		tail[1] = (uint8_t) instr->argc;
+		tail[2] = instr->opcode_bits & 0xff;
+		tail[3] = instr->opcode_bits >> 8;
+		tail[4] = instr->opcode_mask & 0xff;
+		tail[5] = instr->opcode_mask >> 8;
+
+		for (size_t j = 0; j < sizeof fields; j++) {
+			hash ^= fields[j];
+			hash *= 0x100000001b3ULL;
+		}
+	}
+	return hash;
+}
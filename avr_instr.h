@@ -1,7 +1,31 @@
+#pragma once
 #include <stdint.h>
 
 #define INSTRUCTIONS 144
 #define OPCODE_LEN   16
+#define INSTR_NONE   0xff
+
+#define FLOW_NONE   0
+#define FLOW_JUMP   1 // RJMP, JMP
+#define FLOW_BRANCH 2 // BRxx
+#define FLOW_SKIP   3 // CPSE, SBRC, SBRS, SBIC, SBIS
+#define FLOW_CALL   4 // RCALL, CALL
+#define FLOW_IJUMP  5 // IJMP, EIJMP
+#define FLOW_ICALL  6 // ICALL, EICALL
+#define FLOW_RET    7 // RET, RETI
+
+/* SREG flags as used in AVR_Instr.sreg_use / sreg_def */
+#define FLAG_C 0x01
+#define FLAG_Z 0x02
+#define FLAG_N 0x04
+#define FLAG_V 0x08
+#define FLAG_S 0x10
+#define FLAG_H 0x20
+#define FLAG_T 0x40
+#define FLAG_I 0x80
+
+#define REG(r)	  (1u << (r))
+#define REG_PAIR(r) (3u << (r))
 
 typedef struct AVR_Instr {
 
@@ -11,12 +35,28 @@ typedef struct AVR_Instr {
 
 	int	len;
 	int	argc;
+	int	flow;
 
 	uint16_t opcode_bits;
 	uint16_t opcode_mask;
 	uint16_t operand_masks[2];
 
+	/* Dataflow effects: operand_use/def bit i is set when operand i is
+	   read/written, reg_* are registers accessed implicitly (r0:r1 of MUL,
+	   Z of LPM, ...). Pointer operands and branch, BSET/BCLR and IN/OUT
+	   SREG flags depend on the opcode, see decoded_effects(). */
+	uint8_t  operand_use;
+	uint8_t  operand_def;
+	uint8_t  sreg_use;
+	uint8_t  sreg_def;
+	uint32_t reg_use;
+	uint32_t reg_def;
+
 } AVR_Instr;
 
 extern AVR_Instr AVR_INSTRUCTION_SET[INSTRUCTIONS];
-int parse_avr_instructions(char* f);
+extern uint8_t   AVR_DECODE_TABLE[1 << OPCODE_LEN];
+
+int  parse_avr_instructions(char* f);
+void load_avr_instructions(void);
+uint64_t instr_table_version(void);
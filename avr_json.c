@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avr_json.h"
+#include "avr_parse.h"
+#include "avr_decode.h"
+#include "avr_sim.h"
+
+/* Objects are appended to one static buffer with memcpy and hand-rolled
+   number formatting, so nothing is allocated or formatted through printf
+   per instruction; the buffer is flushed when the next object may not fit. */
+
+#define JSON_OBJECT_MAX 512
+
+typedef struct JsonOut {
+
+	char   buf[JSON_BUF];
+	size_t len;
+
+} JsonOut;
+
+static JsonOut OUT;
+
+static const char HEX[] = "0123456789abcdef";
+
+static inline void put_raw(const char* s, size_t n) {
+
+	memcpy(OUT.buf + OUT.len, s, n);
+	OUT.len += n;
+}
+
+#define PUT_LIT(s) put_raw(s, sizeof(s) - 1)
+
+static inline void put_str(const char* s) {
+	put_raw(s, strlen(s));
+}
+
+static inline void put_int(int64_t v) {
+
+	char	 tmp[24];
+	int	 n = 0;
+	uint64_t u = v < 0 ? (uint64_t) -v : (uint64_t) v;
+
+	do {
+		tmp[n++] = '0' + u % 10;
+		u /= 10;
+	} while (u != 0);
+	if (v < 0) {
+		OUT.buf[OUT.len++] = '-';
+	}
+	while (n > 0) {
+		OUT.buf[OUT.len++] = tmp[--n];
+	}
+}
+
+static inline void put_hex(uint32_t v, int digits) {
+
+	for (int i = digits - 1; i >= 0; i--) {
+		OUT.buf[OUT.len++] = HEX[(v >> (i * 4)) & 0xf];
+	}
+}
+
+static void flush(void) {
+
+	fwrite(OUT.buf, 1, OUT.len, stdout);
+	OUT.len = 0;
+}
+
+static void put_operand(const AVR_Decoded* d, int i) {
+
+	const AVR_Instr* instr = &AVR_INSTRUCTION_SET[d->index];
+	int32_t		 value = decoded_operand(d, i);
+
+	switch (instr->operand_types[i]) {
+		case 'r': case 'd': case 'a': case 'v': case 'w':
+			PUT_LIT("{\"type\":\"reg\",\"value\":");
+			put_int(value);
+			break;
+		case 'e': case 'z':
+			PUT_LIT("{\"type\":\"ptr\",\"value\":\"");
+			put_str(instr->operands[i]);
+			PUT_LIT("\"");
+			break;
+		case 'b': // Y+q, Z+q
+			PUT_LIT("{\"type\":\"ptr\",\"value\":\"");
+			put_raw(instr->operands[i], 1);
+			PUT_LIT("\",\"disp\":");
+			put_int(value);
+			break;
+		case 'p': case 'P':
+			PUT_LIT("{\"type\":\"io\",\"value\":");
+			put_int(value);
+			break;
+		case 'l': case 'L': case 'h':
+			PUT_LIT("{\"type\":\"addr\",\"value\":");
+			put_int(branch_target(d));
+			break;
+		default:
+			PUT_LIT("{\"type\":\"imm\",\"value\":");
+			put_int(value);
+	}
+	PUT_LIT("}");
+}
+
+static void put_decoded(const AVR_Decoded* d, const JsonOptions* opts) {
+
+	if (OUT.len > JSON_BUF - JSON_OBJECT_MAX) {
+		flush();
+	}
+
+	PUT_LIT("{\"addr\":");
+	put_int(d->addr);
+	PUT_LIT(",\"bytes\":\"");
+	put_hex(d->opcode, d->len * 2);
+	PUT_LIT("\",\"mnemonic\":\"");
+
+	if (d->index == INSTR_NONE) {
+		if (d->len == 1) PUT_LIT(".db");
+		else		 PUT_LIT(".dw");
+		PUT_LIT("\",\"len\":");
+		put_int(d->len);
+		PUT_LIT(",\"operands\":[]}\n");
+		return;
+	}
+
+	const AVR_Instr* instr = &AVR_INSTRUCTION_SET[d->index];
+	put_str(instr->mnemonic);
+	PUT_LIT("\",\"len\":");
+	put_int(d->len);
+	PUT_LIT(",\"operands\":[");
+	for (int i = 0; i < instr->argc; i++) {
+		if (i > 0) PUT_LIT(",");
+		put_operand(d, i);
+	}
+	PUT_LIT("]");
+
+	if (opts->cycles) {
+		PUT_LIT(",\"cycles\":");
+		put_int(instr_cycles(d));
+	}
+	if (opts->xrefs) {
+		int64_t target = branch_target(d);
+		if (target >= 0) {
+			PUT_LIT(",\"target\":");
+			put_int(target);
+		}
+	}
+	PUT_LIT("}\n");
+}
+
+int json_listing(char* path, int format, const JsonOptions* opts) {
+
+	AVR_Image   img;
+	AVR_Program prog;
+
+	load_avr_instructions();
+	image_init(&img);
+	load_image(path, format, &img);
+	decode_image(&img, &prog);
+
+	size_t i = program_find(&prog, opts->start);
+	if (i == prog.count) {
+		i = 0;
+	}
+	for (; i < prog.count && prog.instrs[i].addr < opts->end; i++) {
+		if (prog.instrs[i].addr >= opts->start) {
+			put_decoded(&prog.instrs[i], opts);
+		}
+	}
+	flush();
+
+	free_program(&prog);
+	image_free(&img);
+	return EXIT_SUCCESS;
+}
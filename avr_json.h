@@ -0,0 +1,23 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/* NDJSON listing: one object per line for every instruction or data word,
+	{"addr":32,"bytes":"940c0034","mnemonic":"JMP","len":4,
+	 "operands":[{"type":"addr","value":52}],"cycles":3,"target":52}
+   Operand types are reg, ptr (with disp for Y+q/Z+q), io, imm and addr
+   (a byte address); data words have mnemonic ".dw" and no operands.
+   "cycles" and "target" are only written when asked for. */
+
+#define JSON_BUF (1 << 20)
+
+typedef struct JsonOptions {
+
+	bool     cycles;
+	bool     xrefs;
+	uint32_t start;
+	uint32_t end;
+
+} JsonOptions;
+
+int json_listing(char* path, int format, const JsonOptions* opts);
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "avr_live.h"
+#include "avr_parse.h"
+#include "avr_disasm.h"
+
+#define MAX_SUCCS 3
+
+static size_t find_start(const AVR_Program* prog, int64_t addr) {
+
+	if (addr < 0 || addr > UINT32_MAX) {
+		return prog->count;
+	}
+	size_t i = program_find(prog, (uint32_t) addr);
+	return i < prog->count && prog->instrs[i].addr == addr ? i : prog->count;
+}
+
+static bool contiguous(const AVR_Program* prog, size_t i) {
+	return i + 1 < prog->count && prog->instrs[i].addr + prog->instrs[i].len == prog->instrs[i + 1].addr;
+}
+
+/* Intraprocedural successors: calls fall through, their effect is
+   summarized by the calling convention. */
+static int successors(const AVR_Program* prog, size_t i, size_t succ[MAX_SUCCS]) {
+
+	const AVR_Decoded* d = &prog->instrs[i];
+	int		   n = 0;
+
+	if (d->index == INSTR_NONE) {
+		return 0;
+	}
+
+	int flow = AVR_INSTRUCTION_SET[d->index].flow;
+	if (flow != FLOW_JUMP && flow != FLOW_IJUMP && flow != FLOW_RET && contiguous(prog, i)) {
+		succ[n++] = i + 1;
+		if (flow == FLOW_SKIP && contiguous(prog, i + 1)) {
+			succ[n++] = i + 2;
+		}
+	}
+	if (flow == FLOW_JUMP || flow == FLOW_BRANCH) {
+		size_t target = find_start(prog, branch_target(d));
+		if (target < prog->count) {
+			succ[n++] = target;
+		}
+	}
+	return n;
+}
+
+static void instr_effects(const AVR_Decoded* d, uint64_t* use, uint64_t* def) {
+
+	decoded_effects(d, use, def);
+	if (d->index == INSTR_NONE) {
+		return;
+	}
+
+	AVR_Instr* instr = &AVR_INSTRUCTION_SET[d->index];
+	switch (instr->flow) {
+		case FLOW_CALL:
+		case FLOW_ICALL:
+			*use |= ABI_ARGS | REG(1);
+			*def |= ABI_CLOBBER | EFFECT_SREG(0xff);
+			break;
+		case FLOW_RET: // RETI returns to code that expects everything intact
+			*use |= !strcmp(instr->mnemonic, "RETI") ? LIVE_ALL : REG(1) | ABI_SAVED | ABI_RETURN;
+			break;
+		case FLOW_IJUMP:
+			*use |= LIVE_ALL;
+			break;
+	}
+}
+
+/* Backward may-liveness over the linear-sweep program: live_in[i] holds
+   the registers (bits 0-31) and SREG flags (bits 32-39) live before
+   instruction i. A set only grows, so each instruction is revisited at
+   most 40 times and the work is linear in the number of edges. */
+void compute_liveness(const AVR_Program* prog, uint64_t* live_in) {
+
+	size_t	  n	 = prog->count;
+	uint64_t* use	 = xcalloc(n, sizeof(uint64_t));
+	uint64_t* def	 = xcalloc(n, sizeof(uint64_t));
+	size_t*	  first	 = xcalloc(n + 1, sizeof(size_t));
+	size_t*	  preds	 = xcalloc(n * MAX_SUCCS + 1, sizeof(size_t));
+	size_t*	  stack	 = xcalloc(n + 1, sizeof(size_t));
+	bool*	  queued = xcalloc(n + 1, sizeof(bool));
+	size_t	  succ[MAX_SUCCS];
+
+	for (size_t i = 0; i < n; i++) {
+		instr_effects(&prog->instrs[i], &use[i], &def[i]);
+		live_in[i] = use[i];
+
+		int count = successors(prog, i, succ);
+		for (int j = 0; j < count; j++) {
+			first[succ[j] + 1]++;
+		}
+	}
+	for (size_t i = 0; i < n; i++) {
+		first[i + 1] += first[i];
+	}
+
+	/* Predecessor lists in one flat array, first[i] .. first[i + 1]. */
+	size_t* fill = xcalloc(n + 1, sizeof(size_t));
+	for (size_t i = 0; i < n; i++) {
+		int count = successors(prog, i, succ);
+		for (int j = 0; j < count; j++) {
+			preds[first[succ[j]] + fill[succ[j]]++] = i;
+		}
+	}
+	free(fill);
+
+	/* Pushed in address order, so the first pass runs backwards. */
+	size_t top = 0;
+	for (size_t i = 0; i < n; i++) {
+		stack[top++] = i;
+		queued[i]    = true;
+	}
+
+	while (top > 0) {
+
+		size_t i = stack[--top];
+		queued[i] = false;
+
+		uint64_t out	= 0;
+		int	 count	= successors(prog, i, succ);
+		for (int j = 0; j < count; j++) {
+			out |= live_in[succ[j]];
+		}
+
+		uint64_t in = use[i] | (out & ~def[i]);
+		if (in == live_in[i]) {
+			continue;
+		}
+		live_in[i] = in;
+
+		for (size_t p = first[i]; p < first[i + 1]; p++) {
+			if (!queued[preds[p]]) {
+				queued[preds[p]] = true;
+				stack[top++]	 = preds[p];
+			}
+		}
+	}
+
+	free(use);
+	free(def);
+	free(first);
+	free(preds);
+	free(stack);
+	free(queued);
+}
+
+/* Register runs and flags of set, e.g. "r1 r24-r25 Z C". */
+int format_live(char* buf, uint64_t set) {
+
+	static const char flags[] = "CZNVSHTI";
+	int len = 0;
+
+	for (int r = 0; r < 32; r++) {
+		if (!((set >> r) & 1)) {
+			continue;
+		}
+		int last = r;
+		while (last + 1 < 32 && ((set >> (last + 1)) & 1)) {
+			last++;
+		}
+		len += last > r ? sprintf(buf + len, "%sr%d-r%d", len ? " " : "", r, last)
+				: sprintf(buf + len, "%sr%d", len ? " " : "", r);
+		r = last;
+	}
+	for (int f = 7; f >= 0; f--) {
+		if ((set >> (32 + f)) & 1) {
+			len += sprintf(buf + len, "%s%c", len ? " " : "", flags[f]);
+		}
+	}
+	buf[len] = '\0';
+	return len;
+}
+
+int live_listing(char* path, int format) {
+
+	AVR_Image   img;
+	AVR_Program prog;
+
+	load_avr_instructions();
+	image_init(&img);
+	load_image(path, format, &img);
+	decode_image(&img, &prog);
+
+	uint64_t* live_in = xcalloc(prog.count + 1, sizeof(uint64_t));
+	compute_liveness(&prog, live_in);
+
+	char note[DISASM_LINE_LEN];
+	for (size_t i = 0; i < prog.count; i++) {
+		note[0] = '\0';
+		if (prog.instrs[i].index != INSTR_NONE) {
+			int len = sprintf(note, "live ");
+			if (format_live(note + len, live_in[i]) == 0) {
+				note[0] = '\0';
+			}
+		}
+		print_decoded_note(&prog.instrs[i], note[0] ? note : NULL);
+	}
+
+	free(live_in);
+	free_program(&prog);
+	image_free(&img);
+	return EXIT_SUCCESS;
+}
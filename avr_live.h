@@ -0,0 +1,14 @@
+#pragma once
+#include <stdint.h>
+#include "avr_decode.h"
+
+/* avr-gcc calling convention, used to summarize calls and returns. */
+#define ABI_ARGS    0x03ffff00u                              // r8-r25
+#define ABI_CLOBBER (REG(0) | 0x0ffc0000u | REG_PAIR(30))    // r0, r18-r27, r30-r31
+#define ABI_SAVED   (0x0003fffcu | REG_PAIR(28))             // r2-r17, r28-r29
+#define ABI_RETURN  0x03fc0000u                              // r18-r25
+#define LIVE_ALL    (0xffffffffu | EFFECT_SREG(0xff))
+
+void compute_liveness(const AVR_Program* prog, uint64_t* live_in);
+int  format_live(char* buf, uint64_t set);
+int  live_listing(char* path, int format);
@@ -1,25 +1,314 @@
 #include "avr_parse.h"
 #include "avr_disasm.h"
+#include "avr_diff.h"
+#include "avr_sig.h"
+#include "avr_search.h"
+#include "avr_index.h"
+#include "avr_repl.h"
+#include "avr_sim.h"
+#include "avr_live.h"
+#include "avr_stack.h"
+#include "avr_flow.h"
+#include "avr_func.h"
+#include "avr_json.h"
+#include "avr_columns.h"
+#include "avr_convert.h"
+#include "avr_merge.h"
+#include "avr_incr.h"
+#include "avr_watch.h"
+#include "avr_cache.h"
+#include "avr_daemon.h"
+#include "avr_count.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
 
-int main(int argc, char* argv[]) {
+static void usage(void) {
+	fprintf(stderr, "Usage: ihex2avr <format> <file_path> [--start <addr>] [--end <addr>] [--index] [--ordered]\n");
+	fprintf(stderr, "       ihex2avr diff <format> <file_a> <file_b>\n");
+	fprintf(stderr, "       ihex2avr sigmake <format> <file_path> <symbols>\n");
+	fprintf(stderr, "       ihex2avr sigscan <format> <file_path> <signatures>\n");
+	fprintf(stderr, "       ihex2avr search <format> <pattern> <file_path>...\n");
+	fprintf(stderr, "       ihex2avr count <format> <file_path>...\n");
+	fprintf(stderr, "       ihex2avr repl <format> <file_path>\n");
+	fprintf(stderr, "       ihex2avr live <format> <file_path>\n");
+	fprintf(stderr, "       ihex2avr stack <format> <file_path>\n");
+	fprintf(stderr, "       ihex2avr flow <format> <file_path>\n");
+	fprintf(stderr, "       ihex2avr functions <format> <file_path>\n");
+	fprintf(stderr, "       ihex2avr callgraph <dot|json|bin> <format> <file_path>\n");
+	fprintf(stderr, "       ihex2avr convert <format> <file_path> <ihex|srec|bin> [--record <bytes>] [--fill <byte>]\n");
+	fprintf(stderr, "       ihex2avr merge <format> <ihex|srec|bin|list> <file_path>...\n");
+	fprintf(stderr, "       ihex2avr incremental <format> <file_path> <output> [--watch]\n");
+	fprintf(stderr, "       ihex2avr columns <format> <file_path> <output>\n");
+	fprintf(stderr, "       ihex2avr json <format> <file_path> [--cycles] [--xrefs] [--start <addr>] [--end <addr>]\n");
+	fprintf(stderr, "       ihex2avr sim <format> <file_path> [--entry <addr>] [--max <steps>] [--ramend <addr>]\n");
+	fprintf(stderr, "                [--profile <listing>] [--folded <stacks>]\n");
+	fprintf(stderr, "       ihex2avr daemon <socket> [--workers <n>]\n");
+	fprintf(stderr, "       ihex2avr client <socket> <arguments>...\n");
+	fprintf(stderr, "<format> is ihex, srec, elf, bin or auto; bin is loaded at --base <addr> (default 0) in any mode\n");
+	fprintf(stderr, "<file_path> - reads stdin; --lenient skips bad hex records and reports them at the end\n");
+	fprintf(stderr, "--cache <dir> [--cache-size <bytes>] keeps listings by input hash and serves repeated runs from it\n");
+}
+
+static int get_format(char* name) {
+
+	int format = parse_format(name);
+	if (format == -1) {
+		fprintf(stderr, "ihex2avr: unknown file format %s", name);
+		exit(EXIT_FAILURE);
+	}
+	return format;
+}
+
+typedef struct ListingArgs {
+
+	char**	 argv;
+	int	 format;
+	uint32_t start;
+	uint32_t end;
+	bool	 range;
+	bool	 indexed;
+	bool	 ordered;
+
+} ListingArgs;
+
+static void render_listing(void* arg) {
+
+	ListingArgs* a = arg;
+	if (a->range || a->indexed) {
+		disasm_range(a->argv[2], a->format, a->start, a->end, a->indexed, a->ordered);
+	}
+	else {
+		parse_hex(a->argv, a->format);
+	}
+}
+
+static int run_command(int argc, char* argv[]) {
+
+	uint32_t base	 = 0;
+	bool	 lenient = false;
+
+	/* --base, --lenient and --cache apply to every mode, so they are taken out before dispatch. */
+	int kept = 1;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--base") == 0 && i + 1 < argc) {
+			base = strtoul(argv[++i], NULL, 0);
+			set_binary_base(base);
+		}
+		else if (strcmp(argv[i], "--lenient") == 0) {
+			lenient = true;
+			set_lenient(true);
+		}
+		else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+			set_cache_dir(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+			set_cache_limit(strtoull(argv[++i], NULL, 0));
+		}
+		else {
+			argv[kept++] = argv[i];
+		}
+	}
+	argc	   = kept;
+	argv[argc] = NULL;
+
+	if (argc == 5 && strcmp(argv[1], "diff") == 0) {
+		return diff_images(argv[3], argv[4], get_format(argv[2]));
+	}
+	if (argc == 5 && strcmp(argv[1], "sigmake") == 0) {
+		return sig_build(argv[3], get_format(argv[2]), argv[4]);
+	}
+	if (argc == 5 && strcmp(argv[1], "sigscan") == 0) {
+		return sig_scan(argv[3], get_format(argv[2]), argv[4]);
+	}
+	if (argc == 4 && strcmp(argv[1], "repl") == 0) {
+		return run_repl(argv[3], get_format(argv[2]));
+	}
+	if (argc == 4 && strcmp(argv[1], "live") == 0) {
+		return live_listing(argv[3], get_format(argv[2]));
+	}
+	if (argc == 4 && strcmp(argv[1], "stack") == 0) {
+		return stack_report(argv[3], get_format(argv[2]));
+	}
+	if (argc == 4 && strcmp(argv[1], "flow") == 0) {
+		return flow_listing(argv[3], get_format(argv[2]));
+	}
+	if (argc == 4 && strcmp(argv[1], "functions") == 0) {
+		return function_listing(argv[3], get_format(argv[2]));
+	}
+	if (argc == 5 && strcmp(argv[1], "callgraph") == 0) {
+		int output = parse_callgraph_format(argv[2]);
+		if (output == -1) {
+			usage();
+			return EXIT_FAILURE;
+		}
+		return callgraph_export(argv[4], get_format(argv[3]), output);
+	}
+	if (argc >= 4 && strcmp(argv[1], "count") == 0) {
+		return count_images(argv + 3, argc - 3, get_format(argv[2]));
+	}
+	if (argc >= 5 && strcmp(argv[1], "search") == 0) {
+		return search_images(argv[3], argv + 4, argc - 4, get_format(argv[2]));
+	}
+
+	if (argc >= 5 && strcmp(argv[1], "convert") == 0) {
 
-	if (argc != 3) {
-		fprintf(stderr, "Usage: ihex2avr <format> <file_path>\n");
+		ConvertOptions opts = { parse_format(argv[4]), 16, 0xff };
+
+		if (opts.format != FORMAT_IHEX && opts.format != FORMAT_SREC && opts.format != FORMAT_BIN) {
+			usage();
+			return EXIT_FAILURE;
+		}
+		for (int i = 5; i < argc; i++) {
+			if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+				opts.record_len = (int) strtol(argv[++i], NULL, 0);
+			}
+			else if (strcmp(argv[i], "--fill") == 0 && i + 1 < argc) {
+				opts.fill = (uint8_t) strtoul(argv[++i], NULL, 0);
+			}
+			else {
+				usage();
+				return EXIT_FAILURE;
+			}
+		}
+		return convert_image(argv[3], get_format(argv[2]), &opts);
+	}
+	if (argc >= 5 && strcmp(argv[1], "merge") == 0) {
+		return merge_images(argv + 4, argc - 4, get_format(argv[2]), argv[3]);
+	}
+	if (argc == 5 && strcmp(argv[1], "incremental") == 0) {
+		return incremental_listing(argv[3], get_format(argv[2]), argv[4]);
+	}
+	if (argc == 6 && strcmp(argv[1], "incremental") == 0 && strcmp(argv[5], "--watch") == 0) {
+		return watch_listing(argv[3], get_format(argv[2]), argv[4]);
+	}
+	if (argc == 5 && strcmp(argv[1], "columns") == 0) {
+		return columns_export(argv[3], get_format(argv[2]), argv[4]);
+	}
+	if (argc >= 4 && strcmp(argv[1], "json") == 0) {
+
+		JsonOptions opts = { false, false, 0, UINT32_MAX };
+
+		for (int i = 4; i < argc; i++) {
+			if (strcmp(argv[i], "--cycles") == 0) {
+				opts.cycles = true;
+			}
+			else if (strcmp(argv[i], "--xrefs") == 0) {
+				opts.xrefs = true;
+			}
+			else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc) {
+				opts.start = strtoul(argv[++i], NULL, 0);
+			}
+			else if (strcmp(argv[i], "--end") == 0 && i + 1 < argc) {
+				opts.end = strtoul(argv[++i], NULL, 0);
+			}
+			else {
+				usage();
+				return EXIT_FAILURE;
+			}
+		}
+		return json_listing(argv[3], get_format(argv[2]), &opts);
+	}
+
+	if (argc >= 4 && strcmp(argv[1], "sim") == 0) {
+
+		SimOptions opts = { 0, UINT64_MAX, 0x08ff, NULL, NULL };
+
+		for (int i = 4; i < argc; i++) {
+			if (strcmp(argv[i], "--entry") == 0 && i + 1 < argc) {
+				opts.entry = strtoul(argv[++i], NULL, 0);
+			}
+			else if (strcmp(argv[i], "--max") == 0 && i + 1 < argc) {
+				opts.max_steps = strtoull(argv[++i], NULL, 0);
+			}
+			else if (strcmp(argv[i], "--ramend") == 0 && i + 1 < argc) {
+				opts.ramend = (uint16_t) strtoul(argv[++i], NULL, 0);
+			}
+			else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+				opts.listing = argv[++i];
+			}
+			else if (strcmp(argv[i], "--folded") == 0 && i + 1 < argc) {
+				opts.folded = argv[++i];
+			}
+			else {
+				usage();
+				return EXIT_FAILURE;
+			}
+		}
+		return run_sim(argv[3], get_format(argv[2]), &opts);
+	}
+
+	if (argc < 3) {
+		usage();
 		return EXIT_FAILURE;
 	} 
 
-	int format = -1;
-	if (strcmp(argv[1], "ihex") == 0) format = FORMAT_IHEX;
-	if (strcmp(argv[1], "srec") == 0) format = FORMAT_SREC;
+	bool	 range   = false;
+	bool	 indexed = false;
+	bool	 ordered = false;
+	uint32_t start   = 0;
+	uint32_t end     = UINT32_MAX;
 
-	if (format == -1) {
-		fprintf(stderr, "ihex2avr: unknown file format %s", argv[1]);
+	for (int i = 3; i < argc; i++) {
+		if (strcmp(argv[i], "--index") == 0) {
+			indexed = true;
+		}
+		else if (strcmp(argv[i], "--ordered") == 0) {
+			ordered = true;
+		}
+		else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc) {
+			start = strtoul(argv[++i], NULL, 0);
+			range = true;
+		}
+		else if (strcmp(argv[i], "--end") == 0 && i + 1 < argc) {
+			end   = strtoul(argv[++i], NULL, 0);
+			range = true;
+		}
+		else {
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	int format = get_format(argv[1]);
+	if (indexed && format == FORMAT_AUTO) {
+		format = detect_format(argv[2]);
+	}
+	if (indexed && ((format != FORMAT_IHEX && format != FORMAT_SREC) || is_stdin(argv[2]))) {
+		fprintf(stderr, "ihex2avr: --index needs an ihex or srec file\n");
 		return EXIT_FAILURE;
-	} 
+	}
+
+	ListingArgs args = { argv, format, start, end, range, indexed, ordered };
 
-	parse_hex(argv, format);
+	/* Lenient runs report on stderr, which the cache does not keep. */
+	if (cache_enabled() && !lenient && !is_stdin(argv[2])) {
+		uint32_t options[] = { format, base, start, end, range, indexed, ordered };
+		return cache_output(argv[2], options, sizeof options / sizeof options[0], render_listing, &args);
+	}
+
+	render_listing(&args);
 	return EXIT_SUCCESS;
 }
+
+int main(int argc, char* argv[]) {
+
+	if (argc >= 3 && strcmp(argv[1], "daemon") == 0) {
+		int workers = 0;
+		if (argc == 5 && strcmp(argv[3], "--workers") == 0) {
+			workers = (int) strtol(argv[4], NULL, 0);
+		}
+		else if (argc != 3) {
+			usage();
+			return EXIT_FAILURE;
+		}
+		return run_daemon(argv[2], workers, run_command);
+	}
+	if (argc >= 4 && strcmp(argv[1], "client") == 0) {
+		return run_client(argv[2], argc - 3, argv + 3);
+	}
+
+	return run_command(argc, argv);
+}
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avr_merge.h"
+#include "avr_parse.h"
+#include "avr_decode.h"
+#include "avr_convert.h"
+
+/* Inputs are loaded separately, so each is a set of disjoint segments
+   and overlaps can only be between inputs. All segments are sorted by
+   start once and swept: a segment is compared against the ones still
+   open at its start, which are exactly those it overlaps. */
+
+typedef struct Piece {
+
+	uint32_t       addr;
+	uint32_t       end;
+	int	       input;
+	const uint8_t* data;
+
+} Piece;
+
+static int cmp_piece(const void* a, const void* b) {
+
+	const Piece* x = a;
+	const Piece* y = b;
+	if (x->addr != y->addr) {
+		return (x->addr > y->addr) - (x->addr < y->addr);
+	}
+	return x->input - y->input;
+}
+
+/* Reports the overlap of a (earlier input) and b, returns whether their
+   bytes differ. */
+static bool check_overlap(const Piece* a, const Piece* b, char** paths) {
+
+	uint32_t lo = a->addr > b->addr ? a->addr : b->addr;
+	uint32_t hi = a->end < b->end ? a->end : b->end;
+	uint32_t differ = 0, first = 0;
+
+	const uint8_t* pa = a->data + (lo - a->addr);
+	const uint8_t* pb = b->data + (lo - b->addr);
+	if (memcmp(pa, pb, hi - lo) != 0) {
+		for (uint32_t i = 0; i < hi - lo; i++) {
+			if (pa[i] != pb[i] && differ++ == 0) first = i;
+		}
+	}
+
+	const Piece* x = a->input < b->input ? a : b;
+	const Piece* y = a->input < b->input ? b : a;
+	if (differ == 0) {
+		fprintf(stderr, "ihex2avr: 0x%04X-0x%04X: %s and %s overlap with the same bytes\n",
+			lo, hi - 1, paths[x->input], paths[y->input]);
+		return false;
+	}
+	fprintf(stderr, "ihex2avr: 0x%04X-0x%04X: %s and %s conflict in %u bytes, first at 0x%04X (0x%02X, 0x%02X)\n",
+		lo, hi - 1, paths[x->input], paths[y->input], differ, lo + first,
+		x->data[lo + first - x->addr], y->data[lo + first - y->addr]);
+	return true;
+}
+
+int merge_images(char** paths, int count, int format, char* output) {
+
+	ConvertOptions opts = { parse_format(output), 16, 0xff };
+	bool	       list = strcmp(output, "list") == 0;
+
+	if (!list && opts.format != FORMAT_IHEX && opts.format != FORMAT_SREC && opts.format != FORMAT_BIN) {
+		fprintf(stderr, "ihex2avr: unknown merge output %s\n", output);
+		return EXIT_FAILURE;
+	}
+
+	AVR_Image* imgs	   = xcalloc(count, sizeof(AVR_Image));
+	size_t	   npieces = 0;
+	for (int i = 0; i < count; i++) {
+		image_init(&imgs[i]);
+		load_image(paths[i], format, &imgs[i]);
+		npieces += imgs[i].count;
+	}
+
+	Piece* pieces = xcalloc(npieces, sizeof(Piece));
+	size_t n      = 0;
+	for (int i = 0; i < count; i++) {
+		for (int s = 0; s < imgs[i].count; s++) {
+			AVR_Segment* seg = &imgs[i].segs[s];
+			pieces[n++]	 = (Piece) { seg->addr, seg->addr + seg->len, i, seg->data };
+		}
+	}
+	qsort(pieces, npieces, sizeof(Piece), cmp_piece);
+
+	Piece** open	  = xcalloc(npieces, sizeof(Piece*));
+	size_t	nopen	  = 0;
+	size_t	conflicts = 0;
+	for (size_t p = 0; p < npieces; p++) {
+		size_t kept = 0;
+		for (size_t o = 0; o < nopen; o++) {
+			if (open[o]->end > pieces[p].addr) {
+				open[kept++] = open[o];
+				conflicts   += check_overlap(open[o], &pieces[p], paths);
+			}
+		}
+		nopen	     = kept;
+		open[nopen++] = &pieces[p];
+	}
+
+	/* Later inputs win, as later records do within one file. */
+	AVR_Image merged;
+	image_init(&merged);
+	for (int i = 0; i < count; i++) {
+		for (int s = 0; s < imgs[i].count; s++) {
+			image_write(&merged, imgs[i].segs[s].addr, imgs[i].segs[s].data, imgs[i].segs[s].len);
+		}
+	}
+
+	if (list) {
+		AVR_Program prog;
+		load_avr_instructions();
+		decode_image(&merged, &prog);
+		for (size_t i = 0; i < prog.count; i++) {
+			print_decoded(&prog.instrs[i]);
+		}
+		free_program(&prog);
+	}
+	else {
+		write_image(&merged, &opts);
+	}
+	if (conflicts > 0) {
+		fprintf(stderr, "ihex2avr: %zu conflicting overlap%s, later inputs kept\n", conflicts, conflicts == 1 ? "" : "s");
+	}
+
+	for (int i = 0; i < count; i++) {
+		image_free(&imgs[i]);
+	}
+	image_free(&merged);
+	free(imgs);
+	free(pieces);
+	free(open);
+	return conflicts > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+/* output is "list" for a listing of the merged image, else ihex, srec
+   or bin as in convert. */
+int merge_images(char** paths, int count, int format, char* output);
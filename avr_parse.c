@@ -5,92 +5,185 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#else
+#include <io.h>
+#include <fcntl.h>
+#endif
 #include <errno.h>
 #include <limits.h>
+#include <setjmp.h>
 #include "avr_disasm.h"
 #include "avr_parse.h"
+#include "avr_image.h"
+#include "avr_decode.h"
+#include "avr_elf.h"
 
 #define IHEX_REC_TYPE_DATA 0
+#define IHEX_REC_TYPE_ESA  2
+#define IHEX_REC_TYPE_ELA  4
 #define SREC_REC_TYPE_DATA 1
-#define REC_LEN_BYTES 32
-#define REC_LEN_CHARS 64
+#define REC_LEN_BYTES 255
+#define REC_LEN_CHARS 510
+#define STREAM_BUF    (1 << 20) // stdin buffer, records are read a byte at a time
+#define DETECT_HEAD   16	// bytes looked at by detect_format
+#define STREAM_CHUNK  (1 << 16) // raw binary streamed to the listing per read
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
 
-static int temp_len;
-static uint8_t temp_arr[4];
-static FILE* file;
+// Reader state is per thread so images can be loaded concurrently
+static THREAD_LOCAL int temp_len;
+static THREAD_LOCAL uint8_t temp_arr[4];
+static THREAD_LOCAL FILE* file;
+static THREAD_LOCAL AVR_Image* image;
+static THREAD_LOCAL uint32_t base;
+
+// Lenient mode: fail() records a diagnostic and jumps back to read_hex,
+// which skips to the next record mark
+static THREAD_LOCAL bool	     resync_ready;
+static THREAD_LOCAL jmp_buf	     resync;
+static THREAD_LOCAL size_t	     line_no;
+static THREAD_LOCAL int		     column;
+static THREAD_LOCAL int64_t	     rec_addr;
+static THREAD_LOCAL ParseDiagnostic* diags;
+static THREAD_LOCAL size_t	     ndiags;
+static THREAD_LOCAL size_t	     diags_cap;
+
+static uint32_t binary_base;
+static bool	lenient; // set once for the process, seen by every reader thread
+static char	stdin_buf[STREAM_BUF];
+static bool	stdin_ready;
+static uint8_t* stdin_data; // stdin read whole by map_file
 
 static bool checksum_cmp(uint8_t sum, uint8_t checksum, int format) {
 	return format != FORMAT_IHEX ? (0xff - (sum & 0xff)) == checksum : ((~sum + 1) & 0xff) == checksum;
 }
 
-static uint16_t hex_to_int(char *nptr) {
+static uint32_t hex_to_int(char *nptr) {
 
 	char* endptr = NULL;
 	errno = 0;
 	
-	uint16_t i = strtoul(nptr, &endptr, 16);
+	uint32_t i = strtoul(nptr, &endptr, 16);
 	if (nptr == endptr || (i == 0 && errno != 0)) {
-		fprintf(stderr, "ihex2avr: bad input %s\n", nptr);
+		if (!resync_ready) fprintf(stderr, "ihex2avr: bad input %s\n", nptr);
 		errno = EINVAL;
 	}
 
 	return i;
 }
 
-static void fail(char *error_message) {
+static void fail_checksum(char* error_message, int expected, int actual) {
+
+	if (resync_ready) {
+		if (ndiags == diags_cap) {
+			diags_cap = diags_cap ? diags_cap * 2 : 16;
+			diags	  = xrealloc(diags, diags_cap * sizeof(ParseDiagnostic));
+		}
+		ParseDiagnostic* d = &diags[ndiags++];
+		d->line	    = line_no;
+		d->column   = column;
+		d->addr	    = rec_addr;
+		d->expected = expected;
+		d->actual   = actual;
+		d->message  = error_message;
+		longjmp(resync, 1);
+	}
+
 	fputs(error_message, stderr);
 	fclose(file);
 	exit(EXIT_FAILURE);
 }
 
+static void fail(char *error_message) {
+	fail_checksum(error_message, -1, -1);
+}
+
+static int srec_addr_len(uint8_t type) {
+	switch (type) {
+		case 2: case 8: return 3;
+		case 3: case 7: return 4;
+		default: return 2;
+	}
+}
+
+static bool is_data_rec(uint8_t type, int format) {
+	return format == FORMAT_IHEX ? type == IHEX_REC_TYPE_DATA : type >= SREC_REC_TYPE_DATA && type <= 3;
+}
+
 static void parse_hexrec(
 	int	 format,
 	size_t*  offset, 
 	uint16_t len, 
 	uint8_t  checksum, 
 	uint8_t  type, 
-	uint16_t addr, 
+	uint32_t addr, 
 	char*	 rec_buff, 
 	uint8_t* uint_buff) 
 {
-	uint8_t msb, lsb, sum, count = 0;
-	char lsb_buff[3];
-	char msb_buff[3];
-
-	for (int i = 0; i < len - (len % 4); i += 4) {
-
-		strncpy(msb_buff, rec_buff + i, 2);
-		strncpy(lsb_buff, rec_buff + i + 2, 2);
+	uint8_t data[REC_LEN_BYTES];
+	uint8_t sum = 0;
+	char byte_buff[3] = { 0 };
+
+	for (int i = 0; i < len / 2; i++) {
+		strncpy(byte_buff, rec_buff + i * 2, 2);
+		data[i] = hex_to_int(byte_buff); if (errno != 0) { column += i * 2; fail("ihex2avr: hex conversion error\n"); }
+		sum += data[i];
+	}
 
-		msb = hex_to_int(msb_buff); if (errno != 0) fail("ihex2avr: hex conversion error\n");
-		lsb = hex_to_int(lsb_buff); if (errno != 0) fail("ihex2avr: hex conversion error\n");
-		sum = sum + msb + lsb;
+	if (format == FORMAT_IHEX) {
+		sum += type + (len / 2) + (addr >> 8) + (addr & 0xff);
+	}
+	else {
+		int addr_len = srec_addr_len(type);
+		sum += len / 2 + addr_len + 1;
+		for (int i = 0; i < addr_len; i++) {
+			sum += addr >> (i * 8);
+		}
+	}
 
-#ifdef _DEBUG
-		printf("%02X %02X ", msb, lsb);
-#endif
+	if (!checksum_cmp(sum, checksum, format)) {
+		column += len;
+		fail_checksum("ihex2avr: checksum mismatch", format != FORMAT_IHEX ? 0xff - sum : (~sum + 1) & 0xff, checksum);
+	}
 
-		uint_buff[(i / 2) + temp_len]	  = lsb;
-		uint_buff[(i / 2) + 1 + temp_len] = msb;
-		count += 4;
+	if (format == FORMAT_IHEX && (type == IHEX_REC_TYPE_ESA || type == IHEX_REC_TYPE_ELA)) {
+		if (len != 4) fail("ihex2avr: bad extended address record\n");
+		base = ((data[0] << 8) | data[1]) << (type == IHEX_REC_TYPE_ESA ? 4 : 16);
+		return;
 	}
-	if (len % 4 == 2) {
-		strncpy(lsb_buff, rec_buff + count, 2);
-		lsb = hex_to_int(lsb_buff); if (errno != 0) fail("ihex2avr: hex conversion error\n");
-		sum += lsb;
-		uint_buff[(count / 2) + temp_len] = lsb;
+	if (!is_data_rec(type, format)) {
+		return;
+	}
+
+	if (image != NULL) {
+		image_write(image, base + addr, data, len / 2);
+		return;
 	}
 
 #ifdef _DEBUG
+	for (int i = 0; i < len / 2; i++) printf("%02X ", data[i]);
 	printf("\n\n");
 #endif
 
-	sum = format == FORMAT_IHEX ? sum + type + (len / 2) + (addr >> 8) + (addr & 0xff) : 
-		  sum + (len / 2 + 3) + (addr >> 8) + (addr & 0xff);
-
-	if (!checksum_cmp(sum, checksum, format)) {
-		fail("ihex2avr: checksum mismatch");
+	// disasm_hexrec expects every byte pair swapped, carrying over
+	// the bytes of an instruction split between two records.
+	for (int i = 0; i + 1 < len / 2; i += 2) {
+		uint_buff[i + temp_len]     = data[i + 1];
+		uint_buff[i + 1 + temp_len] = data[i];
+	}
+	if ((len / 2) % 2) {
+		uint_buff[len / 2 - 1 + temp_len] = data[len / 2 - 1];
 	}
 
 	memcpy(uint_buff, temp_arr, temp_len);
@@ -101,88 +194,591 @@ static void parse_hexrec(
 #endif
 }
 
-void parse_hex(char* argv[], int format) {
-
-	if (parse_avr_instructions("avr.txt")) {
-		fprintf(stderr, "ihex2avr: failed to parse instructions\n");
-		exit(EXIT_FAILURE);
-	}
-
-	file = fopen(argv[2], "r");
-	if (file == NULL) {
-		fprintf(stderr, "ihex2avr: could not open %s\n", argv[2]);
-		exit(EXIT_FAILURE);
-	}
+/* Reads the record at the current file position, false at the end of input. */
+static bool read_record(int format, size_t* offset) {
 
-	bool	 disasm;
 	uint8_t  type;
 	uint8_t  checksum;
 
 	uint16_t len;
-	uint16_t address;
-	size_t	 offset;
+	uint32_t address;
+	int	 addr_len;
 	
 	char	hrec_start = format == FORMAT_IHEX ? ':' : 'S';
 	char	flen_buff[3];
-	char	addr_buff[5];
+	char	addr_buff[9];
 	char	type_buff[3];
 	char	chks_buff[3];
 	char	hrec_buff[REC_LEN_CHARS + 1];
 	uint8_t uint_buff[REC_LEN_BYTES + 4];
 
-	offset = 0;
+	char ch = fgetc(file);
+	while (lenient && (ch == '\n' || ch == '\r' || ch == ' ' || ch == '\t')) {
+		line_no += ch == '\n';
+		ch	 = fgetc(file);
+	}
+	if (ch != hrec_start) {
+		if (lenient && ch != EOF) {
+			column	 = 1;
+			rec_addr = -1;
+			fail("ihex2avr: expected a record mark\n");
+		}
+		return false;
+	}
 
-	while (!feof(file)) {
+	column	 = 2;
+	rec_addr = -1;
+	if (format == FORMAT_IHEX) {
 
-		char ch = fgetc(file);
-		if (ch != hrec_start) {
-			if (temp_len == 1) print_db(&offset, temp_arr[0]);
-			break;
+		if (fgets(flen_buff, sizeof flen_buff, file) == NULL) fail("ihex2avr: unexpected EOF\n");
+		if (fgets(addr_buff, 5, file) == NULL) fail("ihex2avr: unexpected EOF\n");
+		if (fgets(type_buff, sizeof type_buff, file) == NULL) fail("ihex2avr: unexpected EOF\n");
+
+		type	 = hex_to_int(type_buff); if (errno != 0) fail("ihex2avr hex conversion error\n");
+		addr_len = 2;
+	}
+	else {
+
+		if (fgets(type_buff, 2, file) == NULL) fail("ihex2avr: unexpected EOF\n");
+		type	 = hex_to_int(type_buff); if (errno != 0) fail("ihex2avr hex conversion error\n");
+		addr_len = srec_addr_len(type);
+
+		if (fgets(flen_buff, sizeof flen_buff, file) == NULL) fail("ihex2avr: unexpected EOF\n");
+		if (fgets(addr_buff, addr_len * 2 + 1, file) == NULL) fail("ihex2avr: unexpected EOF\n");
+	}
+
+	len = hex_to_int(flen_buff); if (errno != 0) fail("ihex2avr hex conversion error\n");
+	column	 = format == FORMAT_IHEX ? 4 : 5;
+	address = hex_to_int(addr_buff); if (errno != 0) fail("ihex2avr hex conversion error\n");
+	column	 = format == FORMAT_IHEX ? 10 : 5 + addr_len * 2;
+	rec_addr = (int64_t) base + address;
+	if (format != FORMAT_IHEX) {
+		if (len < addr_len + 1) fail("ihex2avr: bad record length\n");
+		len -= addr_len + 1;
+	}
+	len = len * 2 + 1;
+
+	if (len > 1 && fgets(hrec_buff, len, file) == NULL) fail("ihex2avr: failed to read DATA field\n");
+	if (fgets(chks_buff, sizeof chks_buff, file) == NULL) fail("ihex2avr: failed to read CHECKSUM field\n");
+
+#ifdef _DEBUG
+	printf("Length: %d ", len - 1);
+	printf("Address: 0x%X ", address);
+	printf("Type: 0x%X ", type);	
+#endif
+
+	column	 += len - 1;
+	checksum = hex_to_int(chks_buff); if (errno != 0) fail("ihex2avr: hex conversion error\n");
+	column	 -= len - 1;
+	parse_hexrec(format, offset, len - 1, checksum, type, address, hrec_buff, uint_buff);
+
+	if (fgetc(file) == '\r') {
+		fgetc(file);
+	}
+	line_no++;
+	return true;
+}
+
+bool is_stdin(const char* path) {
+	return strcmp(path, "-") == 0;
+}
+
+/* path, or stdin for "-" in binary mode with a large buffer. */
+static FILE* open_input(char* path, const char* mode) {
+
+	if (is_stdin(path)) {
+		if (!stdin_ready) {
+#ifdef _MSC_VER
+			_setmode(_fileno(stdin), _O_BINARY);
+#endif
+			setvbuf(stdin, stdin_buf, _IOFBF, sizeof stdin_buf);
+			stdin_ready = true;
 		}
+		return stdin;
+	}
 
-		if (format == FORMAT_IHEX) {
+	FILE* fp = fopen(path, mode);
+	if (fp == NULL) {
+		fprintf(stderr, "ihex2avr: could not open %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	return fp;
+}
+
+static void close_input(FILE* fp) {
+	if (fp != stdin) fclose(fp);
+}
 
-			if (fgets(flen_buff, sizeof flen_buff, file) == NULL) fail("ihex2avr: unexpected EOF\n");
-			if (fgets(addr_buff, sizeof addr_buff, file) == NULL) fail("ihex2avr: unexpected EOF\n");
-			if (fgets(type_buff, sizeof type_buff, file) == NULL) fail("ihex2avr: unexpected EOF\n");
+/* Past a bad record: everything up to the next record mark. */
+static void skip_to_mark(int format) {
 
-			type   = hex_to_int(type_buff); if (errno != 0) fail("ihex2avr hex conversion error\n");
-			disasm = type == IHEX_REC_TYPE_DATA;
+	int mark = format == FORMAT_IHEX ? ':' : 'S';
+	int c;
+	while ((c = fgetc(file)) != EOF && c != mark) {
+		line_no += c == '\n';
+	}
+	if (c != EOF) {
+		ungetc(c, file);
+	}
+}
+
+static void report_diagnostics(char* path) {
+
+	for (size_t i = 0; i < ndiags; i++) {
+
+		const ParseDiagnostic* d   = &diags[i];
+		const char*	       msg = d->message;
+		size_t		       len;
+
+		msg += strncmp(msg, "ihex2avr", 8) ? 0 : 8;
+		msg += strspn(msg, ": ");
+		len  = strcspn(msg, "\n");
+
+		fprintf(stderr, "ihex2avr: %s:%zu:%d: ", path, d->line, d->column);
+		if (d->addr >= 0) {
+			fprintf(stderr, "record 0x%04llX: ", (unsigned long long) d->addr);
 		}
-		else {
+		fprintf(stderr, "%.*s", (int) len, msg);
+		if (d->expected >= 0) {
+			fprintf(stderr, " (expected 0x%02X, found 0x%02X)", d->expected, d->actual);
+		}
+		fprintf(stderr, "\n");
+	}
+	if (ndiags > 0) {
+		fprintf(stderr, "ihex2avr: %zu bad record%s skipped in %s\n", ndiags, ndiags == 1 ? "" : "s", path);
+	}
+}
 
-			char result = fgetc(file);
-			if (result == EOF) fail("ihex2avr: unexpected EOF\n");
-			if (fgets(flen_buff, sizeof flen_buff, file) == NULL) fail("ihex2avr: unexpected EOF\n");
-			if (fgets(addr_buff, sizeof addr_buff, file) == NULL) fail("ihex2avr: unexpected EOF\n");
+static void read_hex(char* path, int format, size_t* offset) {
 
-			type   = hex_to_int(&result); if (errno != 0) fail("ihex2avr hex conversion error\n");
-			disasm = type == SREC_REC_TYPE_DATA;
+	file = open_input(path, "r");
+
+	base	 = 0;
+	temp_len = 0;
+	line_no	 = 1;
+	ndiags	 = 0;
+
+	if (lenient) {
+		resync_ready = true;
+		if (setjmp(resync) != 0) {
+			skip_to_mark(format);
 		}
+	}
+	while (!feof(file) && read_record(format, offset));
+	resync_ready = false;
+
+	if (image == NULL && temp_len == 1) {
+		print_db(offset, temp_arr[0]);
+	}
+	if (lenient) {
+		report_diagnostics(path);
+	}
+	close_input(file);
+}
 
-		len = hex_to_int(flen_buff); if (errno != 0) fail("ihex2avr hex conversion error\n");
-		address = hex_to_int(addr_buff); if (errno != 0) fail("ihex2avr hex conversion error\n");
-		len = (len - (format == FORMAT_IHEX ? 0 : 3)) * 2 + 1;
+void set_lenient(bool on) {
+	lenient = on;
+}
 
-		if (fgets(hrec_buff, len, file) == NULL) fail("ihex2avr: failed to read DATA field\n");
-		if (fgets(chks_buff, sizeof chks_buff, file) == NULL) fail("ihex2avr: failed to read CHECKSUM field\n");
+/* Diagnostics of the last lenient read, valid until the next one. */
+size_t parse_diagnostics(const ParseDiagnostic** out) {
+	*out = diags;
+	return ndiags;
+}
 
-		if (disasm) {
+static bool hex_digits(const uint8_t* p, size_t n) {
 
-#ifdef _DEBUG
-			printf("Length: %d ", len - 1);
-			printf("Address: 0x%X ", address);
-			printf("Type: 0x%X ", type);	
+	for (size_t i = 0; i < n; i++) {
+		if (!isxdigit(p[i])) return false;
+	}
+	return true;
+}
+
+/* ':' and a record header of hex digits is Intel HEX, 'S', a type digit
+   and hex digits S-records; otherwise the ELF magic decides. Raw binary
+   can start with ':' or 'S' too (53 c0 is an RJMP), so one byte is not
+   enough. stdin is peeked at in its buffer, which the first read fills
+   from the start. */
+int detect_format(char* path) {
+
+	uint8_t head[DETECT_HEAD] = { 0 };
+	size_t	n;
+	FILE*	fp = open_input(path, "rb");
+
+	if (is_stdin(path)) {
+		int c = getc(fp);
+		ungetc(c, fp);
+		n = c == EOF ? 0 : sizeof head;
+		memcpy(head, stdin_buf, sizeof head); // unread bytes are still zero
+		head[0] = c == EOF ? 0 : (uint8_t) c;
+	}
+	else {
+		n = fread(head, 1, sizeof head, fp);
+		close_input(fp);
+	}
+
+	if (n >= 9 && head[0] == ':' && hex_digits(head + 1, 8)) return FORMAT_IHEX;
+	if (n >= 4 && head[0] == 'S' && head[1] >= '0' && head[1] <= '9' && hex_digits(head + 2, 2)) return FORMAT_SREC;
+	return is_elf(head, n) ? FORMAT_ELF : FORMAT_BIN;
+}
+
+static uint32_t hex_field(char* line, int pos, int chars) {
+
+	char field[9] = { 0 };
+	strncpy(field, line + pos, chars);
+
+	uint32_t value = hex_to_int(field);
+	if (errno != 0 || strlen(field) != (size_t) chars) fail("ihex2avr: bad record header\n");
+	return value;
+}
+
+int parse_format(char* name) {
+	if (strcmp(name, "ihex") == 0) return FORMAT_IHEX;
+	if (strcmp(name, "srec") == 0) return FORMAT_SREC;
+	if (strcmp(name, "bin") == 0)  return FORMAT_BIN;
+	if (strcmp(name, "elf") == 0)  return FORMAT_ELF;
+	if (strcmp(name, "auto") == 0) return FORMAT_AUTO;
+	return -1;
+}
+
+void set_binary_base(uint32_t addr) {
+	binary_base = addr;
+}
+
+/* The whole file, mapped read-only where mmap is available. */
+uint8_t* map_file(char* path, size_t* size) {
+
+	if (is_stdin(path)) { // a pipe cannot be mapped
+		FILE*  fp  = open_input(path, "rb");
+		size_t cap = STREAM_CHUNK;
+		size_t n;
+		*size	   = 0;
+		stdin_data = xcalloc(cap, 1);
+		while ((n = fread(stdin_data + *size, 1, cap - *size, fp)) > 0) {
+			*size += n;
+			if (*size == cap) {
+				cap	  *= 2;
+				stdin_data = xrealloc(stdin_data, cap);
+			}
+		}
+		return stdin_data;
+	}
+
+#ifndef _MSC_VER
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		fprintf(stderr, "ihex2avr: could not open %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	*size = st.st_size;
+	void* data = *size ? mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "ihex2avr: could not map %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	return data;
+#else
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "ihex2avr: could not open %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	fseek(fp, 0, SEEK_END);
+	*size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	uint8_t* data = xcalloc(*size, 1);
+	if (fread(data, 1, *size, fp) != *size) {
+		fprintf(stderr, "ihex2avr: could not read %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	fclose(fp);
+	return data;
+#endif
+}
+
+void unmap_file(uint8_t* data, size_t size) {
+
+	if (data != NULL && data == stdin_data) {
+		free(stdin_data);
+		stdin_data = NULL;
+		return;
+	}
+#ifndef _MSC_VER
+	if (data != NULL) munmap(data, size);
+#else
+	(void) size;
+	free(data);
 #endif
+}
+
+/* Binary and ELF input go from the mapping into the image with one copy. */
+static void read_mapped(char* path, int format, AVR_Image* img, ElfSymbol** syms, size_t* nsyms) {
+
+	size_t	 size;
+	uint8_t* data = map_file(path, &size);
+
+	if (format == FORMAT_ELF) {
+		load_elf(path, data, size, img, syms, nsyms);
+	}
+	else {
+		if ((uint64_t) binary_base + size > UINT32_MAX) {
+			fprintf(stderr, "ihex2avr: %s does not fit above 0x%X\n", path, binary_base);
+			exit(EXIT_FAILURE);
+		}
+		image_write(img, binary_base, data, (uint32_t) size);
+	}
+	unmap_file(data, size);
+}
+
+/* Raw binary from a pipe, listed through the same streaming decoder as
+   hex records, so memory use does not grow with the input. */
+static void stream_binary(char* path) {
+
+	static uint8_t chunk[STREAM_CHUNK];
+	static uint8_t swapped[STREAM_CHUNK + 4];
 
-			checksum = hex_to_int(chks_buff); if (errno != 0) fail("ihex2avr: hex conversion error\n");
-			parse_hexrec(format, &offset, len - 1, checksum, type, address, hrec_buff, uint_buff);
+	FILE*  fp     = open_input(path, "rb");
+	size_t offset = binary_base;
+	size_t n;
+
+	temp_len = 0;
+	while ((n = fread(chunk, 1, sizeof chunk, fp)) > 0) {
+		for (size_t i = 0; i + 1 < n; i += 2) {
+			swapped[temp_len + i]	  = chunk[i + 1];
+			swapped[temp_len + i + 1] = chunk[i];
 		}
-		if (fgetc(file) == '\r') {
-			fgetc(file);
+		if (n % 2) {
+			swapped[temp_len + n - 1] = chunk[n - 1];
 		}
+		memcpy(swapped, temp_arr, temp_len);
+		disasm_hexrec(&temp_len, temp_arr, swapped, (int) n + temp_len, &offset);
+	}
+	if (temp_len == 1) {
+		print_db(&offset, temp_arr[0]);
 	}
+	close_input(fp);
+}
+
+/* Listing of a binary or ELF image, ELF function symbols as labels. */
+static void list_image(char* path, int format) {
+
+	AVR_Image   img;
+	AVR_Program prog;
+	ElfSymbol*  syms  = NULL;
+	size_t	    nsyms = 0;
+
+	image_init(&img);
+	read_mapped(path, format, &img, &syms, &nsyms);
+	decode_image(&img, &prog);
+
+	size_t s = 0;
+	for (size_t i = 0; i < prog.count; i++) {
+		for (; s < nsyms && syms[s].addr <= prog.instrs[i].addr; s++) {
+			if (syms[s].addr == prog.instrs[i].addr && (s == 0 || syms[s - 1].addr != syms[s].addr)) {
+				printf("\n%s:\n", syms[s].name);
+			}
+		}
+		print_decoded(&prog.instrs[i]);
+	}
+
+	free(syms);
+	free_program(&prog);
+	image_free(&img);
+}
+
+void parse_hex(char* argv[], int format) {
+
+	load_avr_instructions();
+
+	if (format == FORMAT_AUTO) {
+		format = detect_format(argv[2]);
+	}
+	if (format == FORMAT_BIN && is_stdin(argv[2])) {
+		stream_binary(argv[2]);
+		return;
+	}
+	if (format == FORMAT_BIN || format == FORMAT_ELF) {
+		list_image(argv[2], format);
+		return;
+	}
+
+	size_t offset = 0;
+	image = NULL;
+	read_hex(argv[2], format, &offset);
+}
+
+void load_image(char* path, int format, AVR_Image* img) {
+
+	if (format == FORMAT_AUTO) {
+		format = detect_format(path);
+	}
+	if (format == FORMAT_BIN || format == FORMAT_ELF) {
+		read_mapped(path, format, img, NULL, NULL);
+		return;
+	}
+
+	size_t offset = 0;
+	image = img;
+	read_hex(path, format, &offset);
+	image = NULL;
+}
+
+/* Header-only pass: file offset, extended address and data range of
+   every data record, no data field is converted. */
+size_t scan_records(char* path, int format, HexRecord** recs) {
+
+	file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "ihex2avr: could not open %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	char   hrec_start = format == FORMAT_IHEX ? ':' : 'S';
+	char   line[REC_LEN_CHARS + 32];
+	size_t count = 0;
+	size_t cap   = 1024;
+
+	*recs = xcalloc(cap, sizeof(HexRecord));
+	base  = 0;
+
+	for (;;) {
+
+		long pos = ftell(file);
+		if (fgets(line, sizeof line, file) == NULL || line[0] != hrec_start) {
+			break;
+		}
+
+		uint32_t type, len, addr;
+		if (format == FORMAT_IHEX) {
+
+			len  = hex_field(line, 1, 2);
+			addr = hex_field(line, 3, 4);
+			type = hex_field(line, 7, 2);
+
+			if ((type == IHEX_REC_TYPE_ESA || type == IHEX_REC_TYPE_ELA) && len == 2) {
+				base = hex_field(line, 9, 4) << (type == IHEX_REC_TYPE_ESA ? 4 : 16);
+				continue;
+			}
+		}
+		else {
+
+			type = hex_field(line, 1, 1);
+			len  = hex_field(line, 2, 2);
+			addr = hex_field(line, 4, srec_addr_len(type) * 2);
+
+			if (len < (uint32_t) srec_addr_len(type) + 1) fail("ihex2avr: bad record length\n");
+			len -= srec_addr_len(type) + 1;
+		}
+
+		if (!is_data_rec(type, format) || len == 0) {
+			continue;
+		}
+		if (count == cap) {
+			cap  *= 2;
+			*recs = xrealloc(*recs, cap * sizeof(HexRecord));
+		}
+
+		HexRecord* rec = &(*recs)[count++];
+		rec->offset = pos;
+		rec->base   = base;
+		rec->addr   = base + addr;
+		rec->len    = len;
+	}
+	fclose(file);
+	return count;
+}
+
+/* Converts only the given records, seeking straight to each of them. */
+void load_records(char* path, int format, AVR_Image* img, const HexRecord* recs, size_t count) {
+
+	file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "ihex2avr: could not open %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	size_t offset = 0;
+	image = img;
+	for (size_t i = 0; i < count; i++) {
+		if (fseek(file, (long) recs[i].offset, SEEK_SET) != 0) fail("ihex2avr: seek failed\n");
+		base = recs[i].base;
+		read_record(format, &offset);
+	}
+	image = NULL;
 	fclose(file);
 }
 
+/* One pass converting only the data records that overlap [lo, hi), the
+   others are skipped after their header. A record for the range may follow
+   higher ones, so every header is read to the end of the input unless the
+   caller knows the records ascend, then reading stops at the first record
+   starting at or past hi. */
+void load_range(char* path, int format, AVR_Image* img, uint32_t lo, uint32_t hi, bool ordered) {
+
+	if (lenient) { // resynchronising needs read_record
+		load_image(path, format, img);
+		return;
+	}
+	if (format == FORMAT_AUTO) {
+		format = detect_format(path);
+	}
+	if (format == FORMAT_BIN || format == FORMAT_ELF) {
+		read_mapped(path, format, img, NULL, NULL);
+		return;
+	}
+
+	file = open_input(path, "r");
+
+	char	 hrec_start = format == FORMAT_IHEX ? ':' : 'S';
+	char	 line[REC_LEN_CHARS + 32];
+	uint8_t	 uint_buff[REC_LEN_BYTES + 4];
+	size_t	 offset     = 0;
 
+	image = img;
+	base  = 0;
+	while (fgets(line, sizeof line, file) != NULL && line[0] == hrec_start) {
+
+		uint32_t type, len, addr;
+		int	 data_pos;
+		if (format == FORMAT_IHEX) {
+
+			len	 = hex_field(line, 1, 2);
+			addr	 = hex_field(line, 3, 4);
+			type	 = hex_field(line, 7, 2);
+			data_pos = 9;
+
+			if ((type == IHEX_REC_TYPE_ESA || type == IHEX_REC_TYPE_ELA) && len == 2) {
+				base = hex_field(line, 9, 4) << (type == IHEX_REC_TYPE_ESA ? 4 : 16);
+				continue;
+			}
+		}
+		else {
+
+			type	 = hex_field(line, 1, 1);
+			len	 = hex_field(line, 2, 2);
+			addr	 = hex_field(line, 4, srec_addr_len(type) * 2);
+			data_pos = 4 + srec_addr_len(type) * 2;
+
+			if (len < (uint32_t) srec_addr_len(type) + 1) fail("ihex2avr: bad record length\n");
+			len -= srec_addr_len(type) + 1;
+		}
+
+		if (!is_data_rec(type, format) || len == 0) {
+			continue;
+		}
+
+		if (base + addr >= hi && ordered) {
+			break;
+		}
+		if (base + addr >= hi || base + addr + len <= lo) {
+			continue;
+		}
+
+		uint8_t checksum = hex_field(line, data_pos + len * 2, 2);
+		parse_hexrec(format, &offset, len * 2, checksum, type, addr, line + data_pos, uint_buff);
+	}
+	image = NULL;
+	close_input(file);
+}
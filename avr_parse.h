@@ -1,4 +1,45 @@
+#pragma once
+#include "avr_image.h"
+
 #define FORMAT_IHEX 0
 #define FORMAT_SREC 1
+#define FORMAT_BIN  2 // raw flash contents, loaded at the --base address
+#define FORMAT_ELF  3
+#define FORMAT_AUTO 4 // detected from the first bytes
+
+typedef struct HexRecord {
+
+	uint64_t offset; // file offset of the record mark
+	uint32_t base;   // extended address in effect
+	uint32_t addr;   // absolute address of the first data byte
+	uint32_t len;    // data bytes
+
+} HexRecord;
+
+/* A record skipped in lenient mode. */
+typedef struct ParseDiagnostic {
+
+	size_t	    line;
+	int	    column;
+	int64_t	    addr;     // record address, -1 if not read yet
+	int	    expected; // checksums, -1 unless they differ
+	int	    actual;
+	const char* message;
+
+} ParseDiagnostic;
+
+int  parse_format(char* name);
+void parse_hex(char* argv[], int format);
+void load_image(char* path, int format, AVR_Image* img);
+void set_binary_base(uint32_t addr);
+int  detect_format(char* path);
+bool is_stdin(const char* path);
+void set_lenient(bool on);
+size_t parse_diagnostics(const ParseDiagnostic** out);
+
+uint8_t* map_file(char* path, size_t* size);
+void	 unmap_file(uint8_t* data, size_t size);
 
-void parse_hex(char* argv[], int format);
\ No newline at end of file
+size_t scan_records(char* path, int format, HexRecord** recs);
+void   load_records(char* path, int format, AVR_Image* img, const HexRecord* recs, size_t count);
+void   load_range(char* path, int format, AVR_Image* img, uint32_t lo, uint32_t hi, bool ordered);
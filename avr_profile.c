@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avr_profile.h"
+#include "avr_decode.h"
+#include "avr_disasm.h"
+
+void profile_init(AVR_Profile* prof, uint32_t words, uint32_t entry) {
+
+	prof->words	 = words;
+	prof->hits	 = xcalloc(words + 2, sizeof(uint64_t));
+	prof->cycles	 = xcalloc(words + 2, sizeof(uint64_t));
+	prof->func_calls = xcalloc(words + 2, sizeof(uint64_t));
+	prof->func_self	 = xcalloc(words + 2, sizeof(uint64_t));
+	prof->func_total = xcalloc(words + 2, sizeof(uint64_t));
+
+	prof->cap   = 256;
+	prof->nodes = xcalloc(prof->cap, sizeof(ProfileNode));
+	prof->count = 1;
+	prof->node  = 0;
+	prof->nodes[0].func  = entry;
+	prof->nodes[0].calls = 1;
+}
+
+void profile_free(AVR_Profile* prof) {
+	free(prof->hits);
+	free(prof->cycles);
+	free(prof->func_calls);
+	free(prof->func_self);
+	free(prof->func_total);
+	free(prof->nodes);
+	memset(prof, 0, sizeof *prof);
+}
+
+void profile_enter(AVR_Profile* prof, uint32_t func) {
+
+	uint32_t parent = prof->node;
+	uint32_t node	= prof->nodes[parent].child;
+
+	while (node != 0 && prof->nodes[node].func != func) {
+		node = prof->nodes[node].sibling;
+	}
+
+	if (node == 0) {
+		if (prof->count == prof->cap) {
+			prof->cap  *= 2;
+			prof->nodes = xrealloc(prof->nodes, prof->cap * sizeof(ProfileNode));
+		}
+		node = prof->count++;
+		memset(&prof->nodes[node], 0, sizeof(ProfileNode));
+		prof->nodes[node].func	  = func;
+		prof->nodes[node].parent  = parent;
+		prof->nodes[node].sibling = prof->nodes[parent].child;
+		prof->nodes[parent].child = node;
+	}
+
+	prof->nodes[node].calls++;
+	prof->node = node;
+}
+
+/* A return with no call on record (e.g. RET used as a computed jump)
+   stays in the root context. */
+void profile_leave(AVR_Profile* prof) {
+	prof->node = prof->nodes[prof->node].parent;
+}
+
+/* Rolls the calling contexts up into the per-routine counters. Inclusive
+   cycles of a recursive routine are counted at its outermost activation. */
+void profile_finish(AVR_Profile* prof) {
+
+	uint64_t* total	 = xcalloc(prof->count, sizeof(uint64_t));
+	uint32_t* active = xcalloc(prof->words + 2, sizeof(uint32_t));
+
+	/* Children are always created after their parent. */
+	for (uint32_t i = prof->count; i-- > 0;) {
+		total[i] += prof->nodes[i].cycles;
+		if (i != 0) {
+			total[prof->nodes[i].parent] += total[i];
+		}
+	}
+
+	uint32_t node = 0;
+	for (;;) {
+		ProfileNode* n = &prof->nodes[node];
+		if (n->func < prof->words) {
+			prof->func_calls[n->func] += n->calls;
+			prof->func_self[n->func]  += n->cycles;
+			if (active[n->func]++ == 0) {
+				prof->func_total[n->func] += total[node];
+			}
+		}
+
+		if (n->child != 0) {
+			node = n->child;
+			continue;
+		}
+		while (node != 0 && prof->nodes[node].sibling == 0) {
+			if (prof->nodes[node].func < prof->words) active[prof->nodes[node].func]--;
+			node = prof->nodes[node].parent;
+		}
+		if (node == 0) {
+			break;
+		}
+		if (prof->nodes[node].func < prof->words) active[prof->nodes[node].func]--;
+		node = prof->nodes[node].sibling;
+	}
+
+	free(total);
+	free(active);
+}
+
+void profile_write_listing(const AVR_Profile* prof, const AVR_Image* img, FILE* fp) {
+
+	AVR_Program prog;
+	decode_image(img, &prog);
+
+	char line[DISASM_LINE_LEN + 64];
+	char note[64];
+
+	for (size_t i = 0; i < prog.count; i++) {
+
+		const AVR_Decoded* d = &prog.instrs[i];
+		uint32_t	   w = d->addr / 2;
+
+		if (w >= prof->words || (d->addr & 1)) {
+			format_decoded(line, d, NULL);
+			fputs(line, fp);
+			continue;
+		}
+		if (prof->func_calls[w] != 0) {
+			fprintf(fp, "\nsub_%04X: %llu calls, %llu self, %llu total cycles\n", d->addr,
+				(unsigned long long) prof->func_calls[w],
+				(unsigned long long) prof->func_self[w],
+				(unsigned long long) prof->func_total[w]);
+		}
+		if (prof->hits[w] != 0) {
+			snprintf(note, sizeof note, "%llux %llu cycles",
+				 (unsigned long long) prof->hits[w], (unsigned long long) prof->cycles[w]);
+		}
+		format_decoded(line, d, prof->hits[w] != 0 ? note : NULL);
+		fputs(line, fp);
+	}
+	free_program(&prog);
+}
+
+/* One "caller;callee count" line per calling context with self cycles,
+   the input format of flamegraph.pl and speedscope. */
+void profile_write_folded(const AVR_Profile* prof, FILE* fp) {
+
+	uint32_t* chain = xcalloc(prof->count, sizeof(uint32_t));
+
+	for (uint32_t i = 0; i < prof->count; i++) {
+
+		if (prof->nodes[i].cycles == 0) {
+			continue;
+		}
+
+		int depth = 0;
+		for (uint32_t node = i; ; node = prof->nodes[node].parent) {
+			chain[depth++] = node;
+			if (node == 0) break;
+		}
+		while (depth-- > 0) {
+			fprintf(fp, "sub_%04X%s", prof->nodes[chain[depth]].func * 2, depth > 0 ? ";" : "");
+		}
+		fprintf(fp, " %llu\n", (unsigned long long) prof->nodes[i].cycles);
+	}
+	free(chain);
+}
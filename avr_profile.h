@@ -0,0 +1,51 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include "avr_image.h"
+
+/* Calling context: one node per distinct chain of calls from the entry
+   routine, so folded stacks need no further bookkeeping. */
+typedef struct ProfileNode {
+
+	uint32_t func;	  // word address of the called routine
+	uint32_t parent;
+	uint32_t child;	  // first callee, 0 if none (node 0 is the root)
+	uint32_t sibling;
+	uint64_t calls;
+	uint64_t cycles;  // self cycles
+
+} ProfileNode;
+
+/* Counters indexed by word address; func_* are only set at routine entries. */
+typedef struct AVR_Profile {
+
+	uint32_t     words;
+	uint64_t*    hits;
+	uint64_t*    cycles;
+	uint64_t*    func_calls;
+	uint64_t*    func_self;
+	uint64_t*    func_total;
+
+	ProfileNode* nodes;
+	uint32_t     count;
+	uint32_t     cap;
+	uint32_t     node; // current context
+
+} AVR_Profile;
+
+static inline void profile_account(AVR_Profile* prof, uint32_t word, uint32_t node, uint64_t cycles) {
+	if (word < prof->words) {
+		prof->hits[word]++;
+		prof->cycles[word]	 += cycles;
+		prof->nodes[node].cycles += cycles;
+	}
+}
+
+void profile_init(AVR_Profile* prof, uint32_t words, uint32_t entry);
+void profile_free(AVR_Profile* prof);
+void profile_enter(AVR_Profile* prof, uint32_t func);
+void profile_leave(AVR_Profile* prof);
+void profile_finish(AVR_Profile* prof);
+
+void profile_write_listing(const AVR_Profile* prof, const AVR_Image* img, FILE* fp);
+void profile_write_folded(const AVR_Profile* prof, FILE* fp);
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "avr_repl.h"
+#include "avr_parse.h"
+#include "avr_decode.h"
+#include "avr_disasm.h"
+#include "avr_search.h"
+
+#define PAGE_SHIFT   8
+#define PAGE_SIZE    (1 << PAGE_SHIFT)
+#define PAGE_CONTEXT 32 // bytes swept ahead of a page to align its first instruction
+#define CACHE_PAGES  1024
+#define CMD_LEN      1024
+
+/* A page of PAGE_SIZE bytes, decoded and formatted on first use and
+   kept in an LRU list until CACHE_PAGES newer pages push it out. */
+typedef struct Page {
+
+	uint32_t     number;
+	int	     count;
+	AVR_Decoded  instrs[PAGE_SIZE];
+	uint32_t     line[PAGE_SIZE + 1]; // offset of each instruction's line in text
+	char*	     text;
+
+	struct Page* prev;
+	struct Page* next;
+	struct Page* chain;
+
+} Page;
+
+typedef struct Xref {
+
+	uint32_t target;
+	uint32_t source;
+
+} Xref;
+
+typedef struct Session {
+
+	AVR_Image img;
+	Page*	  pool;
+	int	  used;
+	Page*	  buckets[CACHE_PAGES * 2];
+	Page*	  head;
+	Page*	  tail;
+	Xref*	  xrefs;
+	size_t	  nxrefs;
+
+} Session;
+
+static Page** bucket(Session* s, uint32_t number) {
+	return &s->buckets[(number * 2654435761u) % (CACHE_PAGES * 2)];
+}
+
+static void unlink_page(Session* s, Page* page) {
+
+	if (page->prev) page->prev->next = page->next; else s->head = page->next;
+	if (page->next) page->next->prev = page->prev; else s->tail = page->prev;
+	page->prev = page->next = NULL;
+}
+
+static void push_front(Session* s, Page* page) {
+
+	page->prev = NULL;
+	page->next = s->head;
+	if (s->head) s->head->prev = page;
+	s->head = page;
+	if (s->tail == NULL) s->tail = page;
+}
+
+static void fill_page(Session* s, Page* page) {
+
+	static AVR_Decoded tmp[PAGE_SIZE + PAGE_CONTEXT];
+	static char	   text[PAGE_SIZE * DISASM_LINE_LEN];
+
+	uint32_t start = page->number << PAGE_SHIFT;
+	uint32_t from  = start > PAGE_CONTEXT ? start - PAGE_CONTEXT : 0;
+	size_t	 count = decode_range(&s->img, from, start + PAGE_SIZE, tmp);
+	uint32_t len   = 0;
+
+	page->count = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (tmp[i].addr >= start) {
+			page->line[page->count]     = len;
+			page->instrs[page->count++] = tmp[i];
+			len += format_decoded(text + len, &tmp[i], NULL);
+		}
+	}
+	page->line[page->count] = len;
+
+	page->text = xrealloc(page->text, len + 1);
+	memcpy(page->text, text, len);
+}
+
+static Page* get_page(Session* s, uint32_t number) {
+
+	Page** chain = bucket(s, number);
+	for (Page* page = *chain; page != NULL; page = page->chain) {
+		if (page->number == number) {
+			unlink_page(s, page);
+			push_front(s, page);
+			return page;
+		}
+	}
+
+	Page* page;
+	if (s->used < CACHE_PAGES) {
+		page = &s->pool[s->used++];
+	}
+	else {
+		page = s->tail;
+		unlink_page(s, page);
+
+		Page** link = bucket(s, page->number);
+		while (*link != page) {
+			link = &(*link)->chain;
+		}
+		*link = page->chain;
+	}
+
+	page->number = number;
+	page->chain  = *chain;
+	*chain	     = page;
+	fill_page(s, page);
+	push_front(s, page);
+	return page;
+}
+
+/* Start of the first segment byte at or after addr, false past the end. */
+static bool next_present(Session* s, uint32_t addr, uint32_t* next) {
+
+	for (int i = 0; i < s->img.count; i++) {
+		AVR_Segment* seg = &s->img.segs[i];
+		if (seg->addr + seg->len > addr) {
+			*next = seg->addr > addr ? seg->addr : addr;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void dis(Session* s, uint32_t addr, long count) {
+
+	while (count > 0 && next_present(s, addr, &addr)) {
+
+		Page* page = get_page(s, addr >> PAGE_SHIFT);
+		for (int i = 0; i < page->count && count > 0; i++) {
+			if (page->instrs[i].addr >= addr) {
+				fwrite(page->text + page->line[i], 1, page->line[i + 1] - page->line[i], stdout);
+				count--;
+			}
+		}
+		if (((page->number + 1) << PAGE_SHIFT) == 0) {
+			break;
+		}
+		addr = (page->number + 1) << PAGE_SHIFT;
+	}
+}
+
+static int cmp_xref(const void* a, const void* b) {
+
+	const Xref* xa = a;
+	const Xref* xb = b;
+	if (xa->target != xb->target) {
+		return (xa->target > xb->target) - (xa->target < xb->target);
+	}
+	return (xa->source > xb->source) - (xa->source < xb->source);
+}
+
+static void build_xrefs(Session* s) {
+
+	AVR_Program prog;
+	decode_image(&s->img, &prog);
+
+	s->xrefs  = xcalloc(prog.count, sizeof(Xref));
+	s->nxrefs = 0;
+	for (size_t i = 0; i < prog.count; i++) {
+		int64_t target = branch_target(&prog.instrs[i]);
+		if (target >= 0 && target <= UINT32_MAX) {
+			s->xrefs[s->nxrefs].target   = (uint32_t) target;
+			s->xrefs[s->nxrefs++].source = prog.instrs[i].addr;
+		}
+	}
+	qsort(s->xrefs, s->nxrefs, sizeof(Xref), cmp_xref);
+	free_program(&prog);
+}
+
+static void xref(Session* s, uint32_t addr) {
+
+	if (s->xrefs == NULL) {
+		build_xrefs(s);
+	}
+
+	size_t lo = 0;
+	size_t hi = s->nxrefs;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (s->xrefs[mid].target < addr) lo = mid + 1;
+		else hi = mid;
+	}
+	for (; lo < s->nxrefs && s->xrefs[lo].target == addr; lo++) {
+		dis(s, s->xrefs[lo].source, 1);
+	}
+}
+
+static void find(Session* s, char* pattern) {
+
+	uint32_t* hits;
+	size_t	  count;
+
+	if (!find_pattern(pattern, &s->img, &hits, &count)) {
+		return;
+	}
+	for (size_t i = 0; i < count; i++) {
+		dis(s, hits[i], 1);
+	}
+	free(hits);
+}
+
+int run_repl(char* path, int format) {
+
+	load_avr_instructions();
+
+	Session* s = xcalloc(1, sizeof(Session));
+	s->pool = xcalloc(CACHE_PAGES, sizeof(Page));
+	image_init(&s->img);
+	load_image(path, format, &s->img);
+
+	char cmd[CMD_LEN];
+	while (fgets(cmd, sizeof cmd, stdin) != NULL) {
+
+		cmd[strcspn(cmd, "\r\n")] = '\0';
+
+		char*	 name = strtok(cmd, " \t");
+		char*	 arg  = strtok(NULL, " \t");
+		char*	 rest = strtok(NULL, "");
+		uint32_t addr = arg != NULL ? strtoul(arg, NULL, 0) : 0;
+
+		if (name == NULL) {
+			continue;
+		}
+		if (!strcmp(name, "quit") || !strcmp(name, "exit")) {
+			break;
+		}
+
+		if (!strcmp(name, "dis") && arg != NULL) {
+			dis(s, addr, rest != NULL ? strtol(rest, NULL, 0) : 16);
+		}
+		else if (!strcmp(name, "xref") && arg != NULL) {
+			xref(s, addr);
+		}
+		else if (!strcmp(name, "find") && arg != NULL) {
+			if (rest != NULL) arg[strlen(arg)] = ' ';
+			find(s, arg);
+		}
+		else {
+			fprintf(stderr, "ihex2avr: commands are dis <addr> [count], xref <addr>, find <pattern>, quit\n");
+		}
+		puts(".");
+		fflush(stdout);
+	}
+
+	for (int i = 0; i < s->used; i++) {
+		free(s->pool[i].text);
+	}
+	free(s->pool);
+	free(s->xrefs);
+	image_free(&s->img);
+	free(s);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+/* Reads commands from stdin until EOF or "quit":
+
+	dis <addr> [count]   list count instructions from addr
+	xref <addr>          list jumps, branches and calls to addr
+	find <pattern>       search as in "ihex2avr search" */
+
+int run_repl(char* path, int format);
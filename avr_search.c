@@ -0,0 +1,443 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include "avr_search.h"
+#include "avr_parse.h"
+#include "avr_decode.h"
+#include "avr_disasm.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SEARCH_SSE2
+#endif
+
+#ifdef _WIN32
+#define strcasecmp  _stricmp
+#define strncasecmp _strnicmp
+#else
+#include <strings.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define MAX_ALTS     32
+#define MAX_ELEMENTS 32
+
+/* Every table entry a pattern instruction can encode to, as mask/value
+   pairs over one or two flash words. */
+typedef struct Alt {
+
+	uint16_t value[2];
+	uint16_t mask[2];
+	int	 words;
+
+} Alt;
+
+typedef struct Element {
+
+	Alt alts[MAX_ALTS];
+	int count;
+
+} Element;
+
+typedef struct Pattern {
+
+	Element elems[MAX_ELEMENTS];
+	int	count;
+
+} Pattern;
+
+typedef struct SearchJob {
+
+	char*	  path;
+	int	  format;
+	AVR_Image img;
+	uint32_t* hits;
+	size_t	  count;
+	size_t	  cap;
+
+} SearchJob;
+
+static int field_width(AVR_Instr* instr, int i) {
+
+	int width = 0;
+	for (int b = 0; b < OPCODE_LEN; b++) {
+		width += (instr->operand_masks[i] >> b) & 1;
+	}
+	if (instr->operand_masks[i] == 0x3ff) width = 5;
+	if (instr->operand_types[i] == 'i') width += 16;
+	if (instr->operand_types[i] == 'h') width += 16;
+	return width;
+}
+
+static bool parse_number(char* token, int32_t* value) {
+
+	char* endptr = NULL;
+	if (tolower(token[0]) == 'r') token++;
+	if (token[0] == '.') token++;
+
+	*value = strtol(token, &endptr, 0);
+	return endptr != token && *endptr == '\0';
+}
+
+/* Fills alt with entry instr and the operand tokens: 1 on success,
+   0 if they do not fit the entry, -1 if an operand is malformed. */
+static int encode_entry(AVR_Instr* instr, char* ops[2], int argc, Alt* alt) {
+
+	bool     i32   = instr->len == 32;
+	uint32_t value = (uint32_t) instr->opcode_bits << (i32 ? 16 : 0);
+	uint32_t mask  = i32 ? 0xffffffff : 0xffff;
+
+	if (argc != 0 && argc != instr->argc) {
+		return 0;
+	}
+
+	for (int i = 0; i < instr->argc; i++) {
+
+		char  type  = instr->operand_types[i];
+		char* token = argc ? ops[i] : "*";
+
+		AVR_Decoded d = { 0, 0, 0, i32 ? 4 : 2 };
+		d.index = (uint8_t) (instr - AVR_INSTRUCTION_SET);
+		uint32_t field = operand_field(&d, i);
+
+		if (type == 'e' || type == 'z') {
+			if (strcmp(token, "*") && strcasecmp(token, instr->operands[i])) return 0;
+			continue;
+		}
+		if (type == 'b') {
+			if (strncasecmp(token, instr->operands[i], 2)) return 0;
+			token += 2;
+		}
+		if (!strcmp(token, "*")) {
+			mask &= ~field;
+			continue;
+		}
+
+		int32_t operand;
+		if (!parse_number(token, &operand)) {
+			fprintf(stderr, "ihex2avr: bad operand %s\n", token);
+			return -1;
+		}
+
+		int32_t bits = asm_operand(operand, type);
+		if (bits < 0 || (field_width(instr, i) < 31 && bits >= (1 << field_width(instr, i)))) {
+			return 0;
+		}
+		value |= operand_bits_to_opcode(bits, instr->operand_masks[i], instr->len, type);
+	}
+
+	alt->words = i32 ? 2 : 1;
+	if (i32) {
+		alt->value[0] = (value >> 16) & (mask >> 16);
+		alt->mask[0]  = mask >> 16;
+		alt->value[1] = value & mask;
+		alt->mask[1]  = mask;
+	}
+	else {
+		alt->value[0] = value & mask;
+		alt->mask[0]  = mask;
+	}
+	return 1;
+}
+
+static bool compile_element(char* text, Element* elem) {
+
+	char* ops[2] = { NULL, NULL };
+	int   argc   = 0;
+
+	char* mnemonic = strtok(text, " \t");
+	if (mnemonic == NULL) {
+		fprintf(stderr, "ihex2avr: empty pattern element\n");
+		return false;
+	}
+
+	char* token;
+	while ((token = strtok(NULL, " \t,")) != NULL) {
+		if (argc == 2) {
+			fprintf(stderr, "ihex2avr: too many operands for %s\n", mnemonic);
+			return false;
+		}
+		ops[argc++] = token;
+	}
+
+	elem->count = 0;
+	for (int j = 0; j < INSTRUCTIONS && elem->count < MAX_ALTS; j++) {
+
+		Alt alt;
+		memset(&alt, 0, sizeof alt);
+		if (strcasecmp(AVR_INSTRUCTION_SET[j].mnemonic, mnemonic)) {
+			continue;
+		}
+
+		int result = encode_entry(&AVR_INSTRUCTION_SET[j], ops, argc, &alt);
+		if (result < 0) {
+			return false;
+		}
+		if (result == 0) {
+			continue;
+		}
+
+		bool seen = false;
+		for (int k = 0; k < elem->count; k++) {
+			seen |= !memcmp(&elem->alts[k], &alt, sizeof(Alt));
+		}
+		if (!seen) {
+			elem->alts[elem->count++] = alt;
+		}
+	}
+
+	if (elem->count == 0) {
+		fprintf(stderr, "ihex2avr: no encoding for %s\n", mnemonic);
+		return false;
+	}
+	return true;
+}
+
+static bool compile_pattern(char* text, Pattern* pattern) {
+
+	char* copy = xcalloc(strlen(text) + 1, 1);
+	bool  ok   = true;
+	strcpy(copy, text);
+
+	pattern->count = 0;
+	char* next = copy;
+	while (ok && next != NULL) {
+
+		char* end = strchr(next, ';');
+		if (end != NULL) *end = '\0';
+
+		if (pattern->count == MAX_ELEMENTS) {
+			fprintf(stderr, "ihex2avr: pattern too long\n");
+			ok = false;
+			break;
+		}
+		ok = compile_element(next, &pattern->elems[pattern->count++]);
+		next = end != NULL ? end + 1 : NULL;
+	}
+	free(copy);
+	return ok;
+}
+
+static uint16_t word_at(const AVR_Segment* seg, uint32_t offset) {
+	return seg->data[offset] | (seg->data[offset + 1] << 8);
+}
+
+static bool match_from(const Pattern* pattern, int e, const AVR_Segment* seg, uint32_t offset) {
+
+	if (e == pattern->count) {
+		return true;
+	}
+
+	const Element* elem = &pattern->elems[e];
+	for (int a = 0; a < elem->count; a++) {
+
+		const Alt* alt = &elem->alts[a];
+		if (offset + alt->words * 2 > seg->len) {
+			continue;
+		}
+
+		bool ok = true;
+		for (int w = 0; w < alt->words && ok; w++) {
+			ok = (word_at(seg, offset + w * 2) & alt->mask[w]) == alt->value[w];
+		}
+		if (ok && match_from(pattern, e + 1, seg, offset + alt->words * 2)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void add_hit(SearchJob* job, uint32_t addr) {
+
+	if (job->count == job->cap) {
+		job->cap  = job->cap ? job->cap * 2 : 64;
+		job->hits = xrealloc(job->hits, job->cap * sizeof(uint32_t));
+	}
+	job->hits[job->count++] = addr;
+}
+
+/* The first element is checked eight words at a time, only candidates
+   surviving its mask/value compare are matched in full. */
+static void search_segment(const Pattern* pattern, const AVR_Segment* seg, SearchJob* job) {
+
+	const Element* first = &pattern->elems[0];
+	uint32_t offset = 0;
+
+#ifdef SEARCH_SSE2
+	__m128i masks[MAX_ALTS];
+	__m128i values[MAX_ALTS];
+	for (int a = 0; a < first->count; a++) {
+		masks[a]  = _mm_set1_epi16((short) first->alts[a].mask[0]);
+		values[a] = _mm_set1_epi16((short) first->alts[a].value[0]);
+	}
+
+	for (; offset + 16 <= seg->len; offset += 16) {
+
+		__m128i words = _mm_loadu_si128((const __m128i*) (seg->data + offset));
+		__m128i hit   = _mm_setzero_si128();
+		for (int a = 0; a < first->count; a++) {
+			hit = _mm_or_si128(hit, _mm_cmpeq_epi16(_mm_and_si128(words, masks[a]), values[a]));
+		}
+
+		int bits = _mm_movemask_epi8(hit);
+		for (int w = 0; bits != 0 && w < 8; w++) {
+			if ((bits >> (w * 2)) & 1 && match_from(pattern, 0, seg, offset + w * 2)) {
+				add_hit(job, seg->addr + offset + w * 2);
+			}
+		}
+	}
+#endif
+
+	for (; offset + 1 < seg->len; offset += 2) {
+		if (match_from(pattern, 0, seg, offset)) {
+			add_hit(job, seg->addr + offset);
+		}
+	}
+}
+
+static void run_job(const Pattern* pattern, SearchJob* job) {
+
+	image_init(&job->img);
+	load_image(job->path, job->format, &job->img);
+	for (int s = 0; s < job->img.count; s++) {
+		search_segment(pattern, &job->img.segs[s], job);
+	}
+}
+
+static void print_hits(const Pattern* pattern, SearchJob* job) {
+
+	for (size_t h = 0; h < job->count; h++) {
+
+		printf("%s:0x%04X\n", job->path, job->hits[h]);
+
+		uint32_t addr = job->hits[h];
+		for (int e = 0; e < pattern->count; e++) {
+
+			AVR_Segment* seg = image_find(&job->img, addr);
+			AVR_Decoded  d;
+			uint16_t     word = word_at(seg, addr - seg->addr);
+
+			d.addr   = addr;
+			d.opcode = word;
+			d.index  = AVR_DECODE_TABLE[word];
+			d.len    = 2;
+			if (d.index != INSTR_NONE && AVR_INSTRUCTION_SET[d.index].len == 32 && addr + 4 <= seg->addr + seg->len) {
+				d.opcode = (word << 16) | word_at(seg, addr + 2 - seg->addr);
+				d.len    = 4;
+			}
+
+			fputs("    ", stdout);
+			print_decoded(&d);
+			addr += d.len;
+		}
+	}
+}
+
+/* Addresses in img where the pattern text matches, false if the
+   pattern does not compile. */
+bool find_pattern(char* text, const AVR_Image* img, uint32_t** hits, size_t* count) {
+
+	Pattern*  pattern = xcalloc(1, sizeof(Pattern));
+	SearchJob job;
+
+	memset(&job, 0, sizeof job);
+	if (!compile_pattern(text, pattern)) {
+		free(pattern);
+		return false;
+	}
+	for (int s = 0; s < img->count; s++) {
+		search_segment(pattern, &img->segs[s], &job);
+	}
+
+	free(pattern);
+	*hits  = job.hits;
+	*count = job.count;
+	return true;
+}
+
+#ifndef _WIN32
+typedef struct Workers {
+
+	const Pattern*  pattern;
+	SearchJob*	jobs;
+	int		count;
+	int		next;
+	pthread_mutex_t lock;
+
+} Workers;
+
+static void* search_worker(void* arg) {
+
+	Workers* workers = arg;
+	for (;;) {
+
+		pthread_mutex_lock(&workers->lock);
+		int j = workers->next++;
+		pthread_mutex_unlock(&workers->lock);
+
+		if (j >= workers->count) {
+			return NULL;
+		}
+		run_job(workers->pattern, &workers->jobs[j]);
+	}
+}
+#endif
+
+int search_images(char* text, char* paths[], int count, int format) {
+
+	load_avr_instructions();
+
+	Pattern* pattern = xcalloc(1, sizeof(Pattern));
+	if (!compile_pattern(text, pattern)) {
+		free(pattern);
+		return EXIT_FAILURE;
+	}
+
+	SearchJob* jobs = xcalloc(count, sizeof(SearchJob));
+	for (int j = 0; j < count; j++) {
+		jobs[j].path   = paths[j];
+		jobs[j].format = format;
+	}
+
+#ifndef _WIN32
+	long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1) nthreads = 1;
+	if (nthreads > count) nthreads = count;
+
+	Workers workers;
+	workers.pattern = pattern;
+	workers.jobs    = jobs;
+	workers.count   = count;
+	workers.next    = 0;
+	pthread_mutex_init(&workers.lock, NULL);
+
+	pthread_t* threads = xcalloc(nthreads, sizeof(pthread_t));
+	for (long t = 0; t < nthreads; t++) {
+		pthread_create(&threads[t], NULL, search_worker, &workers);
+	}
+	for (long t = 0; t < nthreads; t++) {
+		pthread_join(threads[t], NULL);
+	}
+	pthread_mutex_destroy(&workers.lock);
+	free(threads);
+#else
+	for (int j = 0; j < count; j++) {
+		run_job(pattern, &jobs[j]);
+	}
+#endif
+
+	size_t total = 0;
+	for (int j = 0; j < count; j++) {
+		print_hits(pattern, &jobs[j]);
+		total += jobs[j].count;
+		free(jobs[j].hits);
+		image_free(&jobs[j].img);
+	}
+
+	free(jobs);
+	free(pattern);
+	return total ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "avr_image.h"
+
+/* Patterns are instructions separated by ';', operands written as in
+   the listing or '*' for any value, e.g. "CLI; OUT 0x3F,*". */
+
+bool find_pattern(char* text, const AVR_Image* img, uint32_t** hits, size_t* count);
+int  search_images(char* pattern, char* paths[], int count, int format);
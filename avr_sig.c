@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "avr_sig.h"
+#include "avr_parse.h"
+#include "avr_decode.h"
+
+#define SIG_NAME_LEN  64
+#define SIG_MAX_WORDS 64
+#define SIG_MIN_WORDS 4
+#define SIG_LINE_LEN  (SIG_NAME_LEN + SIG_MAX_WORDS * 10 + 2)
+
+typedef struct Signature {
+
+	char	 name[SIG_NAME_LEN];
+	int	 count;
+	int	 anchor; // first pair of fully fixed words, -1 if none
+	uint16_t value[SIG_MAX_WORDS];
+	uint16_t mask[SIG_MAX_WORDS];
+
+} Signature;
+
+typedef struct Symbol {
+
+	uint32_t addr;
+	char	 name[SIG_NAME_LEN];
+
+} Symbol;
+
+/* Prefix index: anchor word pair -> run of signatures in sorted order */
+typedef struct IndexSlot {
+
+	uint32_t key;
+	int	 first;
+	int	 count;
+
+} IndexSlot;
+
+typedef struct Match {
+
+	uint32_t addr;
+	int	 sig;
+	int	 len;
+
+} Match;
+
+static uint32_t anchor_key(const Signature* sig) {
+	return ((uint32_t) sig->value[sig->anchor] << 16) | sig->value[sig->anchor + 1];
+}
+
+static int cmp_anchor(const void* a, const void* b) {
+
+	uint32_t ka = anchor_key(a);
+	uint32_t kb = anchor_key(b);
+	return (ka > kb) - (ka < kb);
+}
+
+static int cmp_symbol(const void* a, const void* b) {
+
+	uint32_t aa = ((const Symbol*) a)->addr;
+	uint32_t ab = ((const Symbol*) b)->addr;
+	return (aa > ab) - (aa < ab);
+}
+
+static uint32_t hash_key(uint32_t key) {
+	key ^= key >> 16;
+	key *= 0x45d9f3b;
+	key ^= key >> 16;
+	return key;
+}
+
+static void find_anchor(Signature* sig) {
+
+	sig->anchor = -1;
+	for (int i = 0; i + 1 < sig->count; i++) {
+		if (sig->mask[i] == 0xffff && sig->mask[i + 1] == 0xffff) {
+			sig->anchor = i;
+			return;
+		}
+	}
+}
+
+static bool parse_sig(char* line, Signature* sig) {
+
+	char* token = strtok(line, " \t\r\n");
+	if (token == NULL || token[0] == '#') {
+		return false;
+	}
+
+	strncpy(sig->name, token, SIG_NAME_LEN - 1);
+	sig->name[SIG_NAME_LEN - 1] = '\0';
+	sig->count = 0;
+
+	while ((token = strtok(NULL, " \t\r\n")) != NULL && sig->count < SIG_MAX_WORDS) {
+
+		char* endptr = NULL;
+		sig->value[sig->count] = strtoul(token, &endptr, 16);
+		sig->mask[sig->count]  = *endptr == '/' ? strtoul(endptr + 1, &endptr, 16) : 0xffff;
+		if (*endptr != '\0') {
+			fprintf(stderr, "ihex2avr: bad signature word %s in %s\n", token, sig->name);
+			exit(EXIT_FAILURE);
+		}
+		sig->value[sig->count] &= sig->mask[sig->count];
+		sig->count++;
+	}
+
+	find_anchor(sig);
+	return sig->count > 0;
+}
+
+static Signature* load_sigs(char* db_path, int* count) {
+
+	FILE* fp = fopen(db_path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "ihex2avr: could not open %s\n", db_path);
+		exit(EXIT_FAILURE);
+	}
+
+	char line[SIG_LINE_LEN];
+	int  cap = 256;
+	Signature* sigs = xcalloc(cap, sizeof(Signature));
+
+	*count = 0;
+	while (fgets(line, sizeof line, fp) != NULL) {
+		if (*count == cap) {
+			cap *= 2;
+			sigs = xrealloc(sigs, cap * sizeof(Signature));
+		}
+		if (parse_sig(line, &sigs[*count])) {
+			(*count)++;
+		}
+	}
+	fclose(fp);
+	return sigs;
+}
+
+static bool sig_matches(const AVR_Segment* seg, uint32_t offset, const Signature* sig) {
+
+	if (offset + sig->count * 2 > seg->len) {
+		return false;
+	}
+
+	const uint8_t* p = seg->data + offset;
+	for (int i = 0; i < sig->count; i++) {
+		uint16_t word = p[i * 2] | (p[i * 2 + 1] << 8);
+		if ((word & sig->mask[i]) != sig->value[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void add_match(Match** matches, int* count, int* cap, uint32_t addr, int sig, int len) {
+
+	if (*count == *cap) {
+		*cap = *cap ? *cap * 2 : 64;
+		*matches = xrealloc(*matches, *cap * sizeof(Match));
+	}
+	(*matches)[*count].addr = addr;
+	(*matches)[*count].sig  = sig;
+	(*matches)[*count].len  = len;
+	(*count)++;
+}
+
+static int cmp_match(const void* a, const void* b) {
+
+	const Match* ma = a;
+	const Match* mb = b;
+	if (ma->addr != mb->addr) {
+		return (ma->addr > mb->addr) - (ma->addr < mb->addr);
+	}
+	return mb->len - ma->len;
+}
+
+/* Every word pair of the image is probed in a hash index of signature
+   anchors; candidates are verified in full against the segment bytes.
+   Overlapping hits resolve to the earliest, then longest signature. */
+static Match* scan_image(const AVR_Image* img, Signature* sigs, int nsigs, int* nmatches) {
+
+	int nanchored = 0;
+	for (int i = 0; i < nsigs; i++) {
+		if (sigs[i].anchor >= 0) {
+			Signature tmp = sigs[nanchored];
+			sigs[nanchored++] = sigs[i];
+			sigs[i] = tmp;
+		}
+	}
+	qsort(sigs, nanchored, sizeof(Signature), cmp_anchor);
+
+	uint32_t size = 16;
+	while (size < (uint32_t) nanchored * 2) {
+		size *= 2;
+	}
+
+	IndexSlot* index = xcalloc(size, sizeof(IndexSlot));
+	for (int i = 0; i < nanchored; i++) {
+
+		uint32_t key  = anchor_key(&sigs[i]);
+		uint32_t slot = hash_key(key) & (size - 1);
+		while (index[slot].count && index[slot].key != key) {
+			slot = (slot + 1) & (size - 1);
+		}
+		if (index[slot].count == 0) {
+			index[slot].key   = key;
+			index[slot].first = i;
+		}
+		index[slot].count++;
+	}
+
+	Match* found = NULL;
+	int    cap   = 0;
+	int    count = 0;
+
+	for (int s = 0; s < img->count; s++) {
+
+		const AVR_Segment* seg = &img->segs[s];
+		for (uint32_t offset = 0; offset + 1 < seg->len; offset += 2) {
+
+			for (int i = nanchored; i < nsigs; i++) {
+				if (sig_matches(seg, offset, &sigs[i])) {
+					add_match(&found, &count, &cap, seg->addr + offset, i, sigs[i].count);
+				}
+			}
+			if (offset + 3 >= seg->len) {
+				continue;
+			}
+
+			const uint8_t* p = seg->data + offset;
+			uint32_t key  = ((uint32_t) (p[0] | (p[1] << 8)) << 16) | (p[2] | (p[3] << 8));
+			uint32_t slot = hash_key(key) & (size - 1);
+
+			while (index[slot].count && index[slot].key != key) {
+				slot = (slot + 1) & (size - 1);
+			}
+			for (int i = index[slot].first; i < index[slot].first + index[slot].count; i++) {
+				uint32_t back = sigs[i].anchor * 2;
+				if (back <= offset && sig_matches(seg, offset - back, &sigs[i])) {
+					add_match(&found, &count, &cap, seg->addr + offset - back, i, sigs[i].count);
+				}
+			}
+		}
+	}
+	free(index);
+
+	qsort(found, count, sizeof(Match), cmp_match);
+
+	uint32_t covered = 0;
+	*nmatches = 0;
+	for (int i = 0; i < count; i++) {
+		if (found[i].addr >= covered) {
+			found[(*nmatches)++] = found[i];
+			covered = found[i].addr + found[i].len * 2;
+		}
+	}
+	return found;
+}
+
+static Symbol* load_symbols(char* symbols_path, int* count) {
+
+	FILE* fp = fopen(symbols_path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "ihex2avr: could not open %s\n", symbols_path);
+		exit(EXIT_FAILURE);
+	}
+
+	char line[256];
+	char type;
+	int  cap = 256;
+	Symbol* syms = xcalloc(cap, sizeof(Symbol));
+
+	// "<addr> <name>" or avr-nm's "<addr> <type> <name>"
+	*count = 0;
+	while (fgets(line, sizeof line, fp) != NULL) {
+
+		Symbol sym;
+		if (sscanf(line, "%x %c %63s", &sym.addr, &type, sym.name) == 3) {
+			if (strchr("tTwW", type) == NULL) continue;
+		}
+		else if (sscanf(line, "%x %63s", &sym.addr, sym.name) != 2) {
+			continue;
+		}
+
+		if (*count == cap) {
+			cap *= 2;
+			syms = xrealloc(syms, cap * sizeof(Symbol));
+		}
+		syms[(*count)++] = sym;
+	}
+	fclose(fp);
+
+	qsort(syms, *count, sizeof(Symbol), cmp_symbol);
+	return syms;
+}
+
+/* Absolute targets and data addresses are relocated by the linker, as
+   are relative calls and jumps leaving the function: wildcard them. */
+static uint32_t fixed_bits(const AVR_Decoded* d, uint32_t start, uint32_t end) {
+
+	uint32_t mask = d->len == 4 ? 0xffffffff : 0xffff;
+	if (d->index == INSTR_NONE) {
+		return mask;
+	}
+
+	AVR_Instr* instr = &AVR_INSTRUCTION_SET[d->index];
+	for (int i = 0; i < instr->argc; i++) {
+
+		char type = instr->operand_types[i];
+		if (type == 'h' || type == 'i') {
+			mask &= ~operand_field(d, i);
+		}
+		if (type == 'l' || type == 'L') {
+			int64_t target = branch_target(d);
+			if (target < start || target >= end) mask &= ~operand_field(d, i);
+		}
+	}
+	return mask;
+}
+
+int sig_build(char* path, int format, char* symbols_path) {
+
+	load_avr_instructions();
+
+	AVR_Image   img;
+	AVR_Program prog;
+	int nsyms;
+
+	image_init(&img);
+	load_image(path, format, &img);
+	decode_image(&img, &prog);
+	Symbol* syms = load_symbols(symbols_path, &nsyms);
+
+	printf("# signatures from %s\n", path);
+	for (int s = 0; s < nsyms; s++) {
+
+		size_t i = program_find(&prog, syms[s].addr);
+		if (i == prog.count || prog.instrs[i].addr != syms[s].addr) {
+			fprintf(stderr, "ihex2avr: %s at 0x%04X is not in the image\n", syms[s].name, syms[s].addr);
+			continue;
+		}
+
+		uint32_t start = syms[s].addr;
+		uint32_t end   = UINT32_MAX;
+		for (int n = s + 1; n < nsyms; n++) {
+			if (syms[n].addr > start) { end = syms[n].addr; break; }
+		}
+
+		Signature sig;
+		sig.count = 0;
+		for (; i < prog.count && prog.instrs[i].addr < end; i++) {
+
+			const AVR_Decoded* d = &prog.instrs[i];
+			if ((i > 0 && prog.instrs[i - 1].addr + prog.instrs[i - 1].len != d->addr) ||
+			    d->len == 1 || sig.count + d->len / 2 > SIG_MAX_WORDS) {
+				break;
+			}
+
+			uint32_t mask = fixed_bits(d, start, end);
+			if (d->len == 4) {
+				sig.value[sig.count]   = (d->opcode >> 16) & (mask >> 16);
+				sig.mask[sig.count++]  = mask >> 16;
+			}
+			sig.value[sig.count]  = d->opcode & mask;
+			sig.mask[sig.count++] = mask;
+		}
+
+		if (sig.count < SIG_MIN_WORDS) {
+			continue;
+		}
+
+		fputs(syms[s].name, stdout);
+		for (int w = 0; w < sig.count; w++) {
+			if (sig.mask[w] == 0xffff) printf(" %04x", sig.value[w]);
+			else printf(" %04x/%04x", sig.value[w], sig.mask[w]);
+		}
+		fputs("\n", stdout);
+	}
+
+	free(syms);
+	free_program(&prog);
+	image_free(&img);
+	return EXIT_SUCCESS;
+}
+
+static const Match* match_at(const Match* matches, int count, uint32_t addr) {
+
+	int lo = 0;
+	int hi = count;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (matches[mid].addr < addr) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo < count && matches[lo].addr == addr ? &matches[lo] : NULL;
+}
+
+int sig_scan(char* path, int format, char* db_path) {
+
+	load_avr_instructions();
+
+	AVR_Image   img;
+	AVR_Program prog;
+	int nsigs, nmatches;
+
+	Signature* sigs = load_sigs(db_path, &nsigs);
+	image_init(&img);
+	load_image(path, format, &img);
+	decode_image(&img, &prog);
+
+	Match* matches = scan_image(&img, sigs, nsigs, &nmatches);
+	int next = 0;
+
+	for (size_t i = 0; i < prog.count; i++) {
+
+		const AVR_Decoded* d = &prog.instrs[i];
+		while (next < nmatches && matches[next].addr < d->addr + d->len) {
+			printf("\n%s:\n", sigs[matches[next++].sig].name);
+		}
+
+		const Match* callee = NULL;
+		int64_t target = branch_target(d);
+		if (target >= 0 && target <= UINT32_MAX) {
+			callee = match_at(matches, nmatches, (uint32_t) target);
+		}
+		print_decoded_note(d, callee != NULL ? sigs[callee->sig].name : NULL);
+	}
+
+	fprintf(stderr, "ihex2avr: %d signatures, %d matches\n", nsigs, nmatches);
+
+	free(matches);
+	free(sigs);
+	free_program(&prog);
+	image_free(&img);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+/* Signature database: one function per line,
+
+	<name> <word>[/<mask>] <word>[/<mask>] ...
+
+   words are flash words in hex, the mask selects the bits that must
+   match (ffff when omitted). Lines starting with '#' are comments. */
+
+int sig_build(char* path, int format, char* symbols_path);
+int sig_scan(char* path, int format, char* db_path);
@@ -0,0 +1,743 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "avr_sim.h"
+#include "avr_parse.h"
+#include "avr_decode.h"
+
+#define FLASH_MAX 0x800000 // 22-bit word addresses
+
+enum {
+	H_ILLEGAL, H_END,
+	H_ADD, H_ADC, H_ADIW, H_SUB, H_SUBI, H_SBC, H_SBCI, H_SBIW,
+	H_AND, H_ANDI, H_OR, H_ORI, H_EOR, H_COM, H_NEG, H_INC, H_DEC,
+	H_MUL, H_MULS, H_MULSU, H_FMUL, H_FMULS, H_FMULSU,
+	H_JMP, H_IJMP, H_EIJMP, H_CALL, H_ICALL, H_EICALL, H_RET, H_RETI,
+	H_CPSE, H_CP, H_CPC, H_CPI, H_SBRC, H_SBRS, H_SBIC, H_SBIS, H_BRBS, H_BRBC,
+	H_MOV, H_MOVW, H_LDI, H_LDS, H_LD, H_STS, H_ST, H_LPM, H_ELPM,
+	H_IN, H_OUT, H_PUSH, H_POP, H_XCH, H_LAS, H_LAC, H_LAT,
+	H_LSR, H_ROR, H_ASR, H_SWAP, H_BSET, H_BCLR, H_SBI, H_CBI, H_BST, H_BLD,
+	H_NOP, H_BREAK, H_SLEEP
+};
+
+typedef struct Handler {
+
+	const char* mnemonic;
+	uint8_t     handler;
+	uint8_t     cycles;
+
+} Handler;
+
+/* Aliases (TST, CLR, LSL, ROL, SBR, CBR, SER) and the named flag and
+   branch instructions run on the handler of the instruction they encode. */
+static const Handler HANDLERS[] = {
+	{ "ADD",  H_ADD,  1 }, { "ADC",  H_ADC,  1 }, { "ADIW", H_ADIW, 2 },
+	{ "SUB",  H_SUB,  1 }, { "SUBI", H_SUBI, 1 }, { "SBC",  H_SBC,  1 },
+	{ "SBCI", H_SBCI, 1 }, { "SBIW", H_SBIW, 2 }, { "AND",  H_AND,  1 },
+	{ "ANDI", H_ANDI, 1 }, { "OR",   H_OR,   1 }, { "ORI",  H_ORI,  1 },
+	{ "EOR",  H_EOR,  1 }, { "COM",  H_COM,  1 }, { "NEG",  H_NEG,  1 },
+	{ "SBR",  H_ORI,  1 }, { "CBR",  H_ANDI, 1 }, { "INC",  H_INC,  1 },
+	{ "DEC",  H_DEC,  1 }, { "TST",  H_AND,  1 }, { "CLR",  H_EOR,  1 },
+	{ "SER",  H_LDI,  1 }, { "MUL",  H_MUL,  2 }, { "MULS", H_MULS, 2 },
+	{ "MULSU", H_MULSU, 2 }, { "FMUL", H_FMUL, 2 }, { "FMULS", H_FMULS, 2 },
+	{ "FMULSU", H_FMULSU, 2 },
+	{ "RJMP", H_JMP,  2 }, { "IJMP", H_IJMP, 2 }, { "EIJMP", H_EIJMP, 2 },
+	{ "JMP",  H_JMP,  3 }, { "RCALL", H_CALL, 3 }, { "ICALL", H_ICALL, 3 },
+	{ "EICALL", H_EICALL, 4 }, { "CALL", H_CALL, 4 }, { "RET", H_RET, 4 },
+	{ "RETI", H_RETI, 4 },
+	{ "CPSE", H_CPSE, 1 }, { "CP",   H_CP,   1 }, { "CPC",  H_CPC,  1 },
+	{ "CPI",  H_CPI,  1 }, { "SBRC", H_SBRC, 1 }, { "SBRS", H_SBRS, 1 },
+	{ "SBIC", H_SBIC, 1 }, { "SBIS", H_SBIS, 1 },
+	{ "MOV",  H_MOV,  1 }, { "MOVW", H_MOVW, 1 }, { "LDI",  H_LDI,  1 },
+	{ "LDS",  H_LDS,  2 }, { "LD",   H_LD,   2 }, { "LDD",  H_LD,   2 },
+	{ "STS",  H_STS,  2 }, { "ST",   H_ST,   2 }, { "STD",  H_ST,   2 },
+	{ "LPM",  H_LPM,  3 }, { "ELPM", H_ELPM, 3 },
+	{ "IN",   H_IN,   1 }, { "OUT",  H_OUT,  1 }, { "PUSH", H_PUSH, 2 },
+	{ "POP",  H_POP,  2 }, { "XCH",  H_XCH,  2 }, { "LAS",  H_LAS,  2 },
+	{ "LAC",  H_LAC,  2 }, { "LAT",  H_LAT,  2 },
+	{ "LSL",  H_ADD,  1 }, { "LSR",  H_LSR,  1 }, { "ROL",  H_ADC,  1 },
+	{ "ROR",  H_ROR,  1 }, { "ASR",  H_ASR,  1 }, { "SWAP", H_SWAP, 1 },
+	{ "SBI",  H_SBI,  2 }, { "CBI",  H_CBI,  2 }, { "BST",  H_BST,  1 },
+	{ "BLD",  H_BLD,  1 },
+	{ "NOP",  H_NOP,  1 }, { "WDR",  H_NOP,  1 }, { "BREAK", H_BREAK, 1 },
+	{ "SLEEP", H_SLEEP, 1 }
+};
+
+static const char* STATUS_NAMES[] = {
+	"running", "returned", "break", "sleep", "illegal instruction", "out of code", "step limit"
+};
+
+/* Pointer register and increment of an X/Y/Z operand such as "-Y" or "Z+q". */
+static void parse_pointer(const char* text, SimOp* op) {
+
+	int8_t step = 0;
+	if (*text == '-') {
+		step = -1;
+		text++;
+	}
+	op->ptr  = 26 + (*text - 'X') * 2;
+	op->step = step != 0 || text[1] != '+' || text[2] == 'q' ? step : 1;
+}
+
+/* Table entry for word, passing over the reduced-core 16-bit LDS/STS,
+   which overlap LDD/STD with displacements of 32 and up. */
+static int classic_index(uint16_t word) {
+
+	int index = AVR_DECODE_TABLE[word];
+	if (index == INSTR_NONE || AVR_INSTRUCTION_SET[index].len != 16 ||
+	    (strcmp(AVR_INSTRUCTION_SET[index].mnemonic, "LDS") && strcmp(AVR_INSTRUCTION_SET[index].mnemonic, "STS"))) {
+		return index;
+	}
+
+	for (int i = index + 1; i < INSTRUCTIONS; i++) {
+		if ((word & AVR_INSTRUCTION_SET[i].opcode_mask) == AVR_INSTRUCTION_SET[i].opcode_bits) {
+			return i;
+		}
+	}
+	return INSTR_NONE;
+}
+
+static const Handler* find_handler(const char* mnemonic) {
+
+	for (size_t i = 0; i < sizeof HANDLERS / sizeof HANDLERS[0]; i++) {
+		if (!strcmp(HANDLERS[i].mnemonic, mnemonic)) {
+			return &HANDLERS[i];
+		}
+	}
+	return NULL;
+}
+
+/* Cycles of d with a 16-bit PC, branches and skips not taken; 0 for
+   data and instructions the simulator does not run. */
+int instr_cycles(const AVR_Decoded* d) {
+
+	static uint8_t cycles[INSTRUCTIONS];
+	static bool    ready;
+
+	if (!ready) {
+		for (int i = 0; i < INSTRUCTIONS; i++) {
+			const AVR_Instr* instr = &AVR_INSTRUCTION_SET[i];
+			const Handler*	 h     = find_handler(instr->mnemonic);
+			if (instr->flow == FLOW_BRANCH || (instr->opcode_bits & 0xff0f) == 0x9408) {
+				cycles[i] = 1;
+			}
+			else if (h != NULL) {
+				cycles[i] = h->cycles;
+			}
+		}
+		ready = true;
+	}
+	return d->index != INSTR_NONE ? cycles[d->index] : 0;
+}
+
+/* Word address of a direct jump, call or branch target; targets off the
+   image go to the first guard record, which ends the run. */
+static int32_t code_target(const AVR_Sim* sim, const AVR_Decoded* d) {
+
+	int64_t target = branch_target(d) / 2;
+	return target >= 0 && target < sim->flash_words ? (int32_t) target : (int32_t) sim->flash_words;
+}
+
+static void predecode(AVR_Sim* sim, uint32_t w, SimOp* op) {
+
+	uint16_t word  = sim->flash[w * 2] | (sim->flash[w * 2 + 1] << 8);
+	int	 index = classic_index(word);
+
+	memset(op, 0, sizeof *op);
+	op->handler = H_ILLEGAL;
+	op->words   = 1;
+
+	if (index == INSTR_NONE) {
+		return;
+	}
+
+	AVR_Instr*	instr = &AVR_INSTRUCTION_SET[index];
+	AVR_Decoded	d     = { w * 2, word, (uint8_t) index, 2 };
+	const Handler*	h     = find_handler(instr->mnemonic);
+
+	if (instr->len == 32) {
+		if (w + 1 >= sim->flash_words) {
+			return;
+		}
+		d.opcode = (word << 16) | sim->flash[w * 2 + 2] | (sim->flash[w * 2 + 3] << 8);
+		d.len	 = 4;
+	}
+
+	if (instr->flow == FLOW_BRANCH) {
+		op->handler = word & 0x0400 ? H_BRBC : H_BRBS;
+		op->cycles  = 1;
+		op->b	    = word & 7;
+		op->k	    = code_target(sim, &d);
+		return;
+	}
+	if ((word & 0xff0f) == 0x9408) { // BSET, BCLR, SEC, CLC, ...
+		op->handler = word & 0x0080 ? H_BCLR : H_BSET;
+		op->cycles  = 1;
+		op->b	    = (word >> 4) & 7;
+		return;
+	}
+	if (h == NULL) { // DES, SPM, ESPM
+		return;
+	}
+
+	op->handler = h->handler;
+	op->cycles  = h->cycles;
+	op->words   = d.len / 2;
+
+	int regs = 0;
+	for (int i = 0; i < instr->argc; i++) {
+
+		int32_t value = decoded_operand(&d, i);
+		switch (instr->operand_types[i]) {
+			case 'r': case 'd': case 'a': case 'v': case 'w':
+				if (regs++ == 0) op->a = (uint8_t) value; else op->b = (uint8_t) value;
+				break;
+			case 'M': case 'K': case 'n': case 's': case 'S':
+				op->b = (uint8_t) value;
+				break;
+			case 'p': case 'P':
+				op->k = value + 0x20;
+				break;
+			case 'i':
+				op->k = value;
+				break;
+			case 'b':
+				op->k = value;
+				parse_pointer(instr->operands[i], op);
+				break;
+			case 'e': case 'z':
+				parse_pointer(instr->operands[i], op);
+				break;
+			case 'l': case 'L': case 'h':
+				op->k = code_target(sim, &d);
+				break;
+		}
+	}
+
+	if (instr->operand_types[0] == 'r' && instr->argc == 1 &&
+	    (op->handler == H_ADD || op->handler == H_ADC || op->handler == H_AND || op->handler == H_EOR)) {
+		op->b = op->a; // TST, CLR, LSL, ROL
+	}
+	if (!strcmp(instr->mnemonic, "SER")) op->b = 0xff;
+	if (op->handler == H_LPM || op->handler == H_ELPM || op->handler == H_XCH ||
+	    op->handler == H_LAS || op->handler == H_LAC || op->handler == H_LAT) {
+		op->ptr = 30;
+	}
+	if (sim->pc_bytes == 3 &&
+	    (op->handler == H_CALL || op->handler == H_ICALL || op->handler == H_RET || op->handler == H_RETI)) {
+		op->cycles++;
+	}
+}
+
+void sim_init(AVR_Sim* sim, const AVR_Image* img, uint32_t entry, uint16_t ramend) {
+
+	load_avr_instructions();
+
+	uint32_t size = 0;
+	for (int i = 0; i < img->count; i++) {
+		uint32_t end = img->segs[i].addr + img->segs[i].len;
+		if (img->segs[i].addr < FLASH_MAX && end > size) {
+			size = end < FLASH_MAX ? end : FLASH_MAX;
+		}
+	}
+	size = (size + 1) & ~1u;
+
+	memset(sim->data, 0, sizeof sim->data);
+	sim->flash	 = xcalloc(size + 4, 1);
+	sim->flash_words = size / 2;
+	sim->pc_bytes	 = size > 0x20000 ? 3 : 2;
+	memset(sim->flash, 0xff, size + 4);
+
+	for (int i = 0; i < img->count; i++) {
+		const AVR_Segment* seg = &img->segs[i];
+		if (seg->addr < size) {
+			memcpy(sim->flash + seg->addr, seg->data, seg->len < size - seg->addr ? seg->len : size - seg->addr);
+		}
+	}
+
+	/* Two guard records past the end stop execution falling off the
+	   image without a bounds check per step. */
+	sim->ops = xcalloc(sim->flash_words + 2, sizeof(SimOp));
+	for (uint32_t w = 0; w < sim->flash_words; w++) {
+		predecode(sim, w, &sim->ops[w]);
+	}
+	for (uint32_t w = sim->flash_words; w < sim->flash_words + 2; w++) {
+		sim->ops[w].handler = H_END;
+		sim->ops[w].words   = 1;
+	}
+
+#ifdef _DEBUG
+	for (uint32_t w = 0; w < sim->flash_words; w++) {
+		const SimOp* op = &sim->ops[w];
+		if ((op->handler == H_JMP || op->handler == H_CALL || op->handler == H_BRBS || op->handler == H_BRBC) &&
+		    (op->k < 0 || (uint32_t) op->k > sim->flash_words)) {
+			fprintf(stderr, "ihex2avr: target 0x%X of 0x%04X outside the guard\n", op->k * 2, w * 2);
+			abort();
+		}
+	}
+#endif
+
+	/* The entry routine returns to SIM_SENTINEL, which ends the run. */
+	uint16_t sp = ramend;
+	sim->data[sp--] = SIM_SENTINEL & 0xff;
+	sim->data[sp--] = (SIM_SENTINEL >> 8) & 0xff;
+	if (sim->pc_bytes == 3) {
+		sim->data[sp--] = (SIM_SENTINEL >> 16) & 0xff;
+	}
+	sim->data[IO_SPL] = sp & 0xff;
+	sim->data[IO_SPH] = sp >> 8;
+	sim->ret_sp	  = ramend;
+
+	sim->pc     = entry / 2 < sim->flash_words ? entry / 2 : sim->flash_words;
+	sim->steps  = 0;
+	sim->cycles = 0;
+	sim->status = SIM_RUNNING;
+}
+
+void sim_free(AVR_Sim* sim) {
+	free(sim->ops);
+	free(sim->flash);
+	sim->ops   = NULL;
+	sim->flash = NULL;
+}
+
+#define FLAG(bit, value) ((uint8_t) (((value) & 1) << (bit)))
+#define WORD(r)		 (R[r] | (R[(r) + 1] << 8))
+
+static inline uint8_t flags_add(uint8_t sreg, uint8_t d, uint8_t r, uint8_t res) {
+
+	uint8_t carry = (d & r) | (r & ~res) | (~res & d);
+	uint8_t v     = ((d & r & ~res) | (~d & ~r & res)) >> 7;
+	uint8_t n     = res >> 7;
+
+	return (sreg & 0xc0) | FLAG(SREG_C, carry >> 7) | FLAG(SREG_Z, res == 0) | FLAG(SREG_N, n) |
+	       FLAG(SREG_V, v) | FLAG(SREG_S, n ^ v) | FLAG(SREG_H, carry >> 3);
+}
+
+/* keep_z: SBC, SBCI and CPC only clear Z, so multi-byte compares work. */
+static inline uint8_t flags_sub(uint8_t sreg, uint8_t d, uint8_t r, uint8_t res, int keep_z) {
+
+	uint8_t borrow = (~d & r) | (r & res) | (res & ~d);
+	uint8_t v      = ((d & ~r & ~res) | (~d & r & res)) >> 7;
+	uint8_t n      = res >> 7;
+	int	z      = res == 0 && (!keep_z || (sreg >> SREG_Z) & 1);
+
+	return (sreg & 0xc0) | FLAG(SREG_C, borrow >> 7) | FLAG(SREG_Z, z) | FLAG(SREG_N, n) |
+	       FLAG(SREG_V, v) | FLAG(SREG_S, n ^ v) | FLAG(SREG_H, borrow >> 3);
+}
+
+/* Z, N, V and S from res; C and H are left alone. */
+static inline uint8_t flags_znv(uint8_t sreg, uint8_t res, uint8_t v) {
+
+	uint8_t n = res >> 7;
+	return (sreg & 0xe1) | FLAG(SREG_Z, res == 0) | FLAG(SREG_N, n) | FLAG(SREG_V, v) | FLAG(SREG_S, n ^ v);
+}
+
+/* LSR, ROR and ASR: C is the bit shifted out, V = N ^ C. */
+static inline uint8_t flags_shift(uint8_t sreg, uint8_t res, uint8_t c) {
+	return (flags_znv(sreg, res, (res >> 7) ^ c) & ~1) | FLAG(SREG_C, c);
+}
+
+static inline uint8_t flags_mul(uint8_t sreg, uint16_t res, uint8_t c) {
+	return (sreg & ~0x03) | FLAG(SREG_C, c) | FLAG(SREG_Z, res == 0);
+}
+
+int sim_run(AVR_Sim* sim, uint64_t max_steps) {
+
+	const SimOp* ops    = sim->ops;
+	uint8_t*     R      = sim->data;
+	uint32_t     words  = sim->flash_words;
+	uint32_t     pc     = sim->pc;
+	uint64_t     steps  = sim->steps;
+	uint64_t     cycles = sim->cycles;
+	uint32_t     ret    = sim->pc_bytes == 3 ? SIM_SENTINEL : SIM_SENTINEL & 0xffff;
+	int	     status = SIM_RUNNING;
+
+	/* The profiler charges each instruction once the next one starts, so
+	   taken branches and skips are included and calls bill the caller. */
+	AVR_Profile* prof   = sim->prof;
+	uint32_t     at     = UINT32_MAX;
+	uint32_t     ctx    = 0;
+	uint64_t     before = cycles;
+
+#define SREG	      R[IO_SREG]
+#define DATA(addr)    R[(uint16_t) (addr)]
+#define PUSH(v)	      do { uint16_t sp_ = R[IO_SPL] | (R[IO_SPH] << 8); DATA(sp_--) = (uint8_t) (v); R[IO_SPL] = sp_ & 0xff; R[IO_SPH] = sp_ >> 8; } while (0)
+#define POP(v)	      do { uint16_t sp_ = R[IO_SPL] | (R[IO_SPH] << 8); (v) = DATA(++sp_); R[IO_SPL] = sp_ & 0xff; R[IO_SPH] = sp_ >> 8; } while (0)
+#define SKIP()	      (cycles += ops[pc + 1].words, pc += 1 + ops[pc + 1].words)
+#define TRANSFER(t)   do { pc = (t); if (pc >= words) { status = SIM_OUT_OF_CODE; goto stop; } } while (0)
+
+	while (steps < max_steps) {
+
+		const SimOp* op = &ops[pc];
+		uint8_t	     d, r, res;
+		uint16_t     w, z;
+		uint32_t     t;
+
+		if (prof != NULL) {
+			profile_account(prof, at, ctx, cycles - before);
+			at     = pc;
+			ctx    = prof->node;
+			before = cycles;
+		}
+
+		steps++;
+		cycles += op->cycles;
+
+		switch (op->handler) {
+
+		case H_ADD:
+			d = R[op->a]; r = R[op->b]; res = d + r;
+			SREG = flags_add(SREG, d, r, res); R[op->a] = res; pc++;
+			break;
+		case H_ADC:
+			d = R[op->a]; r = R[op->b]; res = d + r + (SREG & 1);
+			SREG = flags_add(SREG, d, r, res); R[op->a] = res; pc++;
+			break;
+		case H_SUB:
+			d = R[op->a]; r = R[op->b]; res = d - r;
+			SREG = flags_sub(SREG, d, r, res, 0); R[op->a] = res; pc++;
+			break;
+		case H_SUBI:
+			d = R[op->a]; r = op->b; res = d - r;
+			SREG = flags_sub(SREG, d, r, res, 0); R[op->a] = res; pc++;
+			break;
+		case H_SBC:
+			d = R[op->a]; r = R[op->b]; res = d - r - (SREG & 1);
+			SREG = flags_sub(SREG, d, r, res, 1); R[op->a] = res; pc++;
+			break;
+		case H_SBCI:
+			d = R[op->a]; r = op->b; res = d - r - (SREG & 1);
+			SREG = flags_sub(SREG, d, r, res, 1); R[op->a] = res; pc++;
+			break;
+		case H_CP:
+			d = R[op->a]; r = R[op->b];
+			SREG = flags_sub(SREG, d, r, (uint8_t) (d - r), 0); pc++;
+			break;
+		case H_CPC:
+			d = R[op->a]; r = R[op->b];
+			SREG = flags_sub(SREG, d, r, (uint8_t) (d - r - (SREG & 1)), 1); pc++;
+			break;
+		case H_CPI:
+			d = R[op->a]; r = op->b;
+			SREG = flags_sub(SREG, d, r, (uint8_t) (d - r), 0); pc++;
+			break;
+
+		case H_ADIW:
+		case H_SBIW:
+			z = WORD(op->a);
+			w = op->handler == H_ADIW ? z + op->b : z - op->b;
+			R[op->a] = w & 0xff; R[op->a + 1] = w >> 8;
+			{
+				uint8_t n = w >> 15;
+				uint8_t v = op->handler == H_ADIW ? (~z & w) >> 15 : (z & ~w) >> 15;
+				uint8_t c = op->handler == H_ADIW ? (z & ~w) >> 15 : (~z & w) >> 15;
+				SREG = (SREG & 0xe0) | FLAG(SREG_C, c) | FLAG(SREG_Z, w == 0) | FLAG(SREG_N, n) |
+				       FLAG(SREG_V, v) | FLAG(SREG_S, n ^ v);
+			}
+			pc++;
+			break;
+
+		case H_AND:  res = R[op->a] &= R[op->b]; SREG = flags_znv(SREG, res, 0); pc++; break;
+		case H_ANDI: res = R[op->a] &= op->b;    SREG = flags_znv(SREG, res, 0); pc++; break;
+		case H_OR:   res = R[op->a] |= R[op->b]; SREG = flags_znv(SREG, res, 0); pc++; break;
+		case H_ORI:  res = R[op->a] |= op->b;    SREG = flags_znv(SREG, res, 0); pc++; break;
+		case H_EOR:  res = R[op->a] ^= R[op->b]; SREG = flags_znv(SREG, res, 0); pc++; break;
+		case H_COM:
+			res = R[op->a] = ~R[op->a];
+			SREG = flags_znv(SREG, res, 0) | FLAG(SREG_C, 1); pc++;
+			break;
+		case H_NEG:
+			d = R[op->a]; res = R[op->a] = -d;
+			SREG = (flags_znv(SREG, res, res == 0x80) & ~0x21) | FLAG(SREG_C, res != 0) | FLAG(SREG_H, (res | d) >> 3);
+			pc++;
+			break;
+		case H_INC: res = ++R[op->a]; SREG = flags_znv(SREG, res, res == 0x80); pc++; break;
+		case H_DEC: res = --R[op->a]; SREG = flags_znv(SREG, res, res == 0x7f); pc++; break;
+
+		case H_MUL:
+			w = R[op->a] * R[op->b];
+			SREG = flags_mul(SREG, w, w >> 15); R[0] = w & 0xff; R[1] = w >> 8; pc++;
+			break;
+		case H_MULS:
+			w = (uint16_t) ((int8_t) R[op->a] * (int8_t) R[op->b]);
+			SREG = flags_mul(SREG, w, w >> 15); R[0] = w & 0xff; R[1] = w >> 8; pc++;
+			break;
+		case H_MULSU:
+			w = (uint16_t) ((int8_t) R[op->a] * R[op->b]);
+			SREG = flags_mul(SREG, w, w >> 15); R[0] = w & 0xff; R[1] = w >> 8; pc++;
+			break;
+		case H_FMUL:
+		case H_FMULS:
+		case H_FMULSU:
+			if (op->handler == H_FMUL)       w = (uint16_t) (R[op->a] * R[op->b]);
+			else if (op->handler == H_FMULS) w = (uint16_t) ((int8_t) R[op->a] * (int8_t) R[op->b]);
+			else				 w = (uint16_t) ((int8_t) R[op->a] * R[op->b]);
+			r = w >> 15;
+			w <<= 1;
+			SREG = flags_mul(SREG, w, r); R[0] = w & 0xff; R[1] = w >> 8; pc++;
+			break;
+
+		case H_JMP:
+			pc = op->k;
+			break;
+		case H_IJMP:
+			TRANSFER(WORD(30));
+			break;
+		case H_EIJMP:
+			TRANSFER(((uint32_t) R[IO_EIND] << 16 | WORD(30)) & (FLASH_MAX / 2 - 1));
+			break;
+		case H_CALL:
+		case H_ICALL:
+		case H_EICALL:
+			t = pc + op->words;
+			PUSH(t); PUSH(t >> 8);
+			if (sim->pc_bytes == 3) PUSH(t >> 16);
+			if (op->handler == H_CALL)       pc = op->k;
+			else if (op->handler == H_ICALL) TRANSFER(WORD(30));
+			else				 TRANSFER(((uint32_t) R[IO_EIND] << 16 | WORD(30)) & (FLASH_MAX / 2 - 1));
+			if (prof != NULL) profile_enter(prof, pc);
+			break;
+		case H_RET:
+		case H_RETI:
+			t = 0;
+			if (sim->pc_bytes == 3) { POP(d); t = (uint32_t) d << 16; }
+			POP(d); t |= d << 8;
+			POP(d); t |= d;
+			if (op->handler == H_RETI) SREG |= FLAG(SREG_I, 1);
+			if (prof != NULL) profile_leave(prof);
+			if (t == ret && (R[IO_SPL] | (R[IO_SPH] << 8)) == sim->ret_sp) {
+				pc     = t;
+				status = SIM_RETURNED;
+				goto stop;
+			}
+			TRANSFER(t);
+			break;
+
+		case H_CPSE:
+			if (R[op->a] == R[op->b]) SKIP(); else pc++;
+			break;
+		case H_SBRC:
+			if (!(R[op->a] >> op->b & 1)) SKIP(); else pc++;
+			break;
+		case H_SBRS:
+			if (R[op->a] >> op->b & 1) SKIP(); else pc++;
+			break;
+		case H_SBIC:
+			if (!(R[op->k] >> op->b & 1)) SKIP(); else pc++;
+			break;
+		case H_SBIS:
+			if (R[op->k] >> op->b & 1) SKIP(); else pc++;
+			break;
+		case H_BRBS:
+			if (SREG >> op->b & 1) { pc = op->k; cycles++; } else pc++;
+			break;
+		case H_BRBC:
+			if (!(SREG >> op->b & 1)) { pc = op->k; cycles++; } else pc++;
+			break;
+
+		case H_MOV:  R[op->a] = R[op->b]; pc++; break;
+		case H_MOVW: R[op->a] = R[op->b]; R[op->a + 1] = R[op->b + 1]; pc++; break;
+		case H_LDI:  R[op->a] = op->b; pc++; break;
+
+		case H_LDS:
+			R[op->a] = DATA(op->k); pc += 2;
+			break;
+		case H_STS:
+			DATA(op->k) = R[op->a]; pc += 2;
+			break;
+		case H_LD:
+		case H_ST:
+			z = WORD(op->ptr);
+			if (op->step < 0) z--;
+			if (op->handler == H_LD) R[op->a] = DATA(z + op->k);
+			else			 DATA(z + op->k) = R[op->a];
+			if (op->step > 0) z++;
+			if (op->step != 0) { R[op->ptr] = z & 0xff; R[op->ptr + 1] = z >> 8; }
+			pc++;
+			break;
+		case H_LPM:
+			z = WORD(30);
+			R[op->a] = sim->flash[z < words * 2 ? z : words * 2];
+			if (op->step > 0) { z++; R[30] = z & 0xff; R[31] = z >> 8; }
+			pc++;
+			break;
+		case H_ELPM:
+			t = (uint32_t) R[IO_RAMPZ] << 16 | WORD(30);
+			R[op->a] = sim->flash[t < words * 2 ? t : words * 2];
+			if (op->step > 0) { t++; R[30] = t & 0xff; R[31] = (t >> 8) & 0xff; R[IO_RAMPZ] = (t >> 16) & 0xff; }
+			pc++;
+			break;
+		case H_XCH:
+		case H_LAS:
+		case H_LAC:
+		case H_LAT:
+			z = WORD(30);
+			d = DATA(z);
+			if (op->handler == H_XCH)      DATA(z) = R[op->a];
+			else if (op->handler == H_LAS) DATA(z) = d | R[op->a];
+			else if (op->handler == H_LAC) DATA(z) = d & ~R[op->a];
+			else			       DATA(z) = d ^ R[op->a];
+			R[op->a] = d;
+			pc++;
+			break;
+
+		case H_IN:
+			R[op->a] = R[op->k]; pc++;
+			break;
+		case H_OUT:
+			R[op->k] = R[op->a]; pc++;
+			break;
+		case H_PUSH: PUSH(R[op->a]); pc++; break;
+		case H_POP:  POP(R[op->a]); pc++; break;
+
+		case H_LSR:
+			d = R[op->a]; res = R[op->a] = d >> 1;
+			SREG = flags_shift(SREG, res, d & 1); pc++;
+			break;
+		case H_ROR:
+			d = R[op->a]; res = R[op->a] = (d >> 1) | (SREG << 7);
+			SREG = flags_shift(SREG, res, d & 1); pc++;
+			break;
+		case H_ASR:
+			d = R[op->a]; res = R[op->a] = (d >> 1) | (d & 0x80);
+			SREG = flags_shift(SREG, res, d & 1); pc++;
+			break;
+		case H_SWAP:
+			R[op->a] = (R[op->a] << 4) | (R[op->a] >> 4); pc++;
+			break;
+
+		case H_BSET: SREG |= FLAG(op->b, 1); pc++; break;
+		case H_BCLR: SREG &= ~FLAG(op->b, 1); pc++; break;
+		case H_SBI:  R[op->k] |= FLAG(op->b, 1); pc++; break;
+		case H_CBI:  R[op->k] &= ~FLAG(op->b, 1); pc++; break;
+		case H_BST:  SREG = (SREG & ~FLAG(SREG_T, 1)) | FLAG(SREG_T, R[op->a] >> op->b); pc++; break;
+		case H_BLD:  R[op->a] = (R[op->a] & ~FLAG(op->b, 1)) | FLAG(op->b, SREG >> SREG_T); pc++; break;
+
+		case H_NOP:
+			pc++;
+			break;
+		case H_BREAK:
+			status = SIM_BREAK;
+			goto stop;
+		case H_SLEEP:
+			status = SIM_SLEEP;
+			goto stop;
+		case H_END:
+			at = UINT32_MAX;
+			steps--;
+			status = SIM_OUT_OF_CODE;
+			goto stop;
+		default:
+			at = UINT32_MAX;
+			steps--;
+			cycles -= op->cycles;
+			status = SIM_ILLEGAL;
+			goto stop;
+		}
+	}
+	status = SIM_STEP_LIMIT;
+
+stop:
+	if (prof != NULL) {
+		profile_account(prof, at, ctx, cycles - before);
+	}
+	sim->pc     = pc;
+	sim->steps  = steps;
+	sim->cycles = cycles;
+	sim->status = status;
+	return status;
+
+#undef SREG
+#undef DATA
+#undef PUSH
+#undef POP
+#undef SKIP
+#undef TRANSFER
+}
+
+static void print_state(const AVR_Sim* sim) {
+
+	static const char flags[] = "CZNVSHTI";
+
+	if (sim->status == SIM_RETURNED) {
+		printf("stop:   %s\n", STATUS_NAMES[sim->status]);
+	}
+	else {
+		printf("stop:   %s at 0x%04X\n", STATUS_NAMES[sim->status], sim->pc * 2);
+	}
+	printf("steps:  %llu\n", (unsigned long long) sim->steps);
+	printf("cycles: %llu\n", (unsigned long long) sim->cycles);
+
+	for (int i = 0; i < 32; i += 8) {
+		printf("r%d-r%d:%*s", i, i + 7, i < 8 ? 3 : i < 16 ? 2 : 1, "");
+		for (int j = i; j < i + 8; j++) {
+			printf(" %02X", sim->data[j]);
+		}
+		putchar('\n');
+	}
+
+	printf("sreg:   ");
+	for (int i = 7; i >= 0; i--) {
+		putchar(sim->data[IO_SREG] >> i & 1 ? flags[i] : '-');
+	}
+	printf("\nsp:     0x%04X\n", sim->data[IO_SPL] | (sim->data[IO_SPH] << 8));
+}
+
+static bool write_profile(const AVR_Profile* prof, const AVR_Image* img, char* path, bool folded) {
+
+	FILE* fp = fopen(path, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "ihex2avr: could not write %s\n", path);
+		return false;
+	}
+	if (folded) {
+		profile_write_folded(prof, fp);
+	}
+	else {
+		profile_write_listing(prof, img, fp);
+	}
+	fclose(fp);
+	return true;
+}
+
+int run_sim(char* path, int format, const SimOptions* opts) {
+
+	AVR_Image   img;
+	AVR_Profile prof;
+
+	image_init(&img);
+	load_image(path, format, &img);
+
+	AVR_Sim* sim = xcalloc(1, sizeof(AVR_Sim));
+	sim_init(sim, &img, opts->entry, opts->ramend);
+
+	if (opts->listing != NULL || opts->folded != NULL) {
+		profile_init(&prof, sim->flash_words, sim->pc);
+		sim->prof = &prof;
+	}
+
+	clock_t start = clock();
+	sim_run(sim, opts->max_steps);
+	double secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	print_state(sim);
+	fprintf(stderr, "ihex2avr: %llu instructions in %.3f s (%.1f M/s)\n",
+		(unsigned long long) sim->steps, secs, secs > 0 ? sim->steps / secs / 1e6 : 0.0);
+
+	int status = sim->status;
+	bool ok	   = status == SIM_RETURNED || status == SIM_BREAK || status == SIM_SLEEP;
+
+	if (sim->prof != NULL) {
+		profile_finish(&prof);
+		if (opts->listing != NULL) ok &= write_profile(&prof, &img, opts->listing, false);
+		if (opts->folded != NULL)  ok &= write_profile(&prof, &img, opts->folded, true);
+		profile_free(&prof);
+	}
+
+	sim_free(sim);
+	free(sim);
+	image_free(&img);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
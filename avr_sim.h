@@ -0,0 +1,85 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "avr_image.h"
+#include "avr_profile.h"
+#include "avr_decode.h"
+
+#define SIM_DATA_SIZE 0x10000
+/* Return address pushed below the entry routine. With a 16-bit PC its
+   low word can be a flash address (128 KB parts), so a return only ends
+   the run when it also empties the stack down to the sentinel. */
+#define SIM_SENTINEL  0x3fffff
+
+#define IO_RAMPZ 0x5b
+#define IO_EIND  0x5c
+#define IO_SPL   0x5d
+#define IO_SPH   0x5e
+#define IO_SREG  0x5f
+
+#define SREG_C 0
+#define SREG_Z 1
+#define SREG_N 2
+#define SREG_V 3
+#define SREG_S 4
+#define SREG_H 5
+#define SREG_T 6
+#define SREG_I 7
+
+#define SIM_RUNNING     0
+#define SIM_RETURNED    1 // entry routine returned to SIM_SENTINEL
+#define SIM_BREAK       2
+#define SIM_SLEEP       3
+#define SIM_ILLEGAL     4 // data word or unsupported instruction
+#define SIM_OUT_OF_CODE 5
+#define SIM_STEP_LIMIT  6
+
+/* One record per flash word, predecoded from AVR_INSTRUCTION_SET so the
+   run loop never looks at opcode bits again. */
+typedef struct SimOp {
+
+	uint8_t handler;
+	uint8_t words;
+	uint8_t cycles; // base cycle count, taken branches and skips add to it
+	uint8_t ptr;	// X, Y or Z low register for indirect loads and stores
+	int8_t	step;	// +1 post-increment, -1 pre-decrement of ptr
+	uint8_t a;	// first register / I/O address / bit operand
+	uint8_t b;	// second register / bit / immediate operand
+	uint8_t pad;
+	int32_t k;	// data address, displacement or target word address
+
+} SimOp;
+
+typedef struct AVR_Sim {
+
+	SimOp*	 ops;
+	uint8_t* flash;
+	uint32_t flash_words;
+	int	 pc_bytes;
+	uint16_t ret_sp; // SP after the sentinel is popped
+	uint8_t  data[SIM_DATA_SIZE];
+	uint32_t pc;
+	uint64_t steps;
+	uint64_t cycles;
+	int	 status;
+
+	AVR_Profile* prof; // NULL unless profiling
+
+} AVR_Sim;
+
+typedef struct SimOptions {
+
+	uint32_t entry;
+	uint64_t max_steps;
+	uint16_t ramend;
+	char*	 listing; // annotated profile listing, NULL for none
+	char*	 folded;  // folded call stacks, NULL for none
+
+} SimOptions;
+
+void sim_init(AVR_Sim* sim, const AVR_Image* img, uint32_t entry, uint16_t ramend);
+void sim_free(AVR_Sim* sim);
+int  sim_run(AVR_Sim* sim, uint64_t max_steps);
+int  instr_cycles(const AVR_Decoded* d);
+
+int run_sim(char* path, int format, const SimOptions* opts);
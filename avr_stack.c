@@ -0,0 +1,449 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "avr_stack.h"
+#include "avr_parse.h"
+#include "avr_decode.h"
+
+#define IO_SPL	      0x3d
+#define IO_SPH	      0x3e
+#define DEPTH_LIMIT   0x10000 // deeper than any SRAM: a loop that keeps pushing
+#define STATE_NEW     0
+#define STATE_ACTIVE  1
+#define STATE_DONE    2
+
+/* Worst-case stack use in bytes. Each routine is walked once from its
+   entry, recording the depth at every call site; the call graph is then
+   folded bottom-up with memoization, so every routine and edge is
+   visited once. */
+
+typedef struct CallSite {
+
+	uint32_t addr;
+	size_t	 callee;
+	int	 depth; // bytes pushed by the caller before the return address
+
+} CallSite;
+
+typedef struct Function {
+
+	uint32_t  addr;
+	int	  frame; // deepest point reached without calls
+	int	  worst;
+	int	  state;
+	bool	  recursive;
+	bool	  unbounded;
+	bool	  indirect;
+	bool	  unknown_sp;
+	CallSite* calls;
+	int	  ncalls;
+	int	  cap;
+
+} Function;
+
+/* Walk position. sp_reg:sp_reg+1 holds SP as it was at depth sp_depth
+   (after IN from SPL/SPH), adjusted by the SBIW/SUBI/SBCI/SBC of a frame
+   allocation, until OUT writes it back. consts are registers loaded by
+   LDI or cleared, zeros those known to be 0 (r1 on entry, by the avr-gcc
+   ABI). */
+typedef struct Visit {
+
+	size_t	 index;
+	int	 depth;
+	int	 sp_reg;
+	int	 sp_depth;
+	uint32_t consts;
+	uint32_t zeros;
+
+} Visit;
+
+typedef struct Analysis {
+
+	AVR_Program prog;
+	Function*   funcs;
+	size_t	    nfuncs;
+	int	    ret_bytes;
+
+	int*	    depth; // per instruction, valid where stamp == current function + 1
+	size_t*	    stamp;
+	Visit*	    work;
+	size_t	    nwork;
+	size_t	    work_cap;
+
+} Analysis;
+
+static int cmp_u32(const void* a, const void* b) {
+
+	uint32_t x = *(const uint32_t*) a;
+	uint32_t y = *(const uint32_t*) b;
+	return (x > y) - (x < y);
+}
+
+static size_t find_function(const Analysis* an, uint32_t addr) {
+
+	size_t lo = 0;
+	size_t hi = an->nfuncs;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (an->funcs[mid].addr < addr) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo < an->nfuncs && an->funcs[lo].addr == addr ? lo : an->nfuncs;
+}
+
+static size_t find_start(const AVR_Program* prog, int64_t addr) {
+
+	if (addr < 0 || addr > UINT32_MAX) {
+		return prog->count;
+	}
+	size_t i = program_find(prog, (uint32_t) addr);
+	return i < prog->count && prog->instrs[i].addr == addr ? i : prog->count;
+}
+
+static bool contiguous(const AVR_Program* prog, size_t i) {
+	return i + 1 < prog->count && prog->instrs[i].addr + prog->instrs[i].len == prog->instrs[i + 1].addr;
+}
+
+static bool is_mnemonic(const AVR_Decoded* d, const char* mnemonic) {
+	return d->index != INSTR_NONE && !strcmp(AVR_INSTRUCTION_SET[d->index].mnemonic, mnemonic);
+}
+
+static void collect_functions(Analysis* an, const uint32_t* vectors, size_t nvectors) {
+
+	uint32_t* addrs = xcalloc(an->prog.count + nvectors + 1, sizeof(uint32_t));
+	size_t	  count = 0;
+
+	for (size_t i = 0; i < nvectors; i++) {
+		addrs[count++] = vectors[i];
+	}
+	for (size_t i = 0; i < an->prog.count; i++) {
+		const AVR_Decoded* d = &an->prog.instrs[i];
+		if (d->index != INSTR_NONE && AVR_INSTRUCTION_SET[d->index].flow == FLOW_CALL) {
+			int64_t target = branch_target(d);
+			if (target != d->addr + d->len && find_start(&an->prog, target) < an->prog.count) {
+				addrs[count++] = (uint32_t) target;
+			}
+		}
+	}
+	qsort(addrs, count, sizeof(uint32_t), cmp_u32);
+
+	an->funcs  = xcalloc(count + 1, sizeof(Function));
+	an->nfuncs = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (i == 0 || addrs[i] != addrs[i - 1]) {
+			an->funcs[an->nfuncs++].addr = addrs[i];
+		}
+	}
+	free(addrs);
+}
+
+static void add_call(Function* f, uint32_t addr, size_t callee, int depth) {
+
+	if (f->ncalls == f->cap) {
+		f->cap	 = f->cap ? f->cap * 2 : 8;
+		f->calls = xrealloc(f->calls, f->cap * sizeof(CallSite));
+	}
+	f->calls[f->ncalls].addr     = addr;
+	f->calls[f->ncalls].callee   = callee;
+	f->calls[f->ncalls++].depth  = depth;
+}
+
+static void push_visit(Analysis* an, size_t index, const Visit* state) {
+
+	if (an->nwork == an->work_cap) {
+		an->work_cap = an->work_cap ? an->work_cap * 2 : 1024;
+		an->work     = xrealloc(an->work, an->work_cap * sizeof(Visit));
+	}
+	Visit* v = &an->work[an->nwork++];
+	*v	 = *state;
+	v->index = index;
+}
+
+/* SP arithmetic is 16-bit: SUBI/SBCI of lo8(-N)/hi8(-N) give back N. */
+static void wrap_sp(Visit* v) {
+	v->sp_depth = v->depth + (int16_t) (uint16_t) (v->sp_depth - v->depth);
+}
+
+static void track_consts(const AVR_Decoded* d, uint64_t def, Visit* v) {
+
+	v->consts &= ~(uint32_t) def;
+	v->zeros  &= ~(uint32_t) def;
+
+	if (is_mnemonic(d, "LDI")) {
+		v->consts |= REG(decoded_operand(d, 0));
+		if (decoded_operand(d, 1) == 0) v->zeros |= REG(decoded_operand(d, 0));
+	}
+	else if ((is_mnemonic(d, "EOR") || is_mnemonic(d, "SUB")) && decoded_operand(d, 0) == decoded_operand(d, 1)) {
+		v->consts |= REG(decoded_operand(d, 0));
+		v->zeros  |= REG(decoded_operand(d, 0));
+	}
+	else if (is_mnemonic(d, "SER")) {
+		v->consts |= REG(decoded_operand(d, 0));
+	}
+	else if (is_mnemonic(d, "CLR")) {
+		v->consts |= REG(decoded_operand(d, 0));
+		v->zeros  |= REG(decoded_operand(d, 0));
+	}
+	else if (d->index != INSTR_NONE && (AVR_INSTRUCTION_SET[d->index].flow == FLOW_CALL || AVR_INSTRUCTION_SET[d->index].flow == FLOW_ICALL)) {
+		v->consts &= v->zeros & REG(1); // the callee keeps only __zero_reg__ known
+		v->zeros  &= REG(1);
+	}
+}
+
+/* Applies d to the walk state, false if the walk must stop here. */
+static bool step(Analysis* an, Function* f, const AVR_Decoded* d, Visit* v, bool report) {
+
+	AVR_Instr* instr = &AVR_INSTRUCTION_SET[d->index];
+	uint64_t   use, def;
+	int	   sp_reg = v->sp_reg;
+
+	decoded_effects(d, &use, &def);
+	track_consts(d, def, v);
+
+	if (is_mnemonic(d, "PUSH")) {
+		v->depth++;
+	}
+	else if (is_mnemonic(d, "POP")) {
+		v->depth--;
+	}
+	else if (is_mnemonic(d, "IN") && (decoded_operand(d, 1) == IO_SPL || decoded_operand(d, 1) == IO_SPH)) {
+		int reg = decoded_operand(d, 0) - (decoded_operand(d, 1) == IO_SPH);
+		if (decoded_operand(d, 1) == IO_SPL || reg != sp_reg) {
+			v->sp_reg   = reg;
+			v->sp_depth = v->depth;
+		}
+		return true;
+	}
+	else if (is_mnemonic(d, "OUT") && (decoded_operand(d, 0) == IO_SPL || decoded_operand(d, 0) == IO_SPH)) {
+		int reg = decoded_operand(d, 1) - (decoded_operand(d, 0) == IO_SPH);
+		if (sp_reg >= 0 && reg == sp_reg) {
+			v->depth = v->sp_depth;
+		}
+		else if (v->consts & REG(decoded_operand(d, 1))) { // SP set up afresh, as in a reset path
+			v->depth  = 0;
+			v->sp_reg = -1;
+		}
+		else {
+			f->unknown_sp = true;
+		}
+		return true;
+	}
+	else if (sp_reg >= 0 && (is_mnemonic(d, "SBIW") || is_mnemonic(d, "ADIW")) && decoded_operand(d, 0) == sp_reg) {
+		v->sp_depth += is_mnemonic(d, "SBIW") ? decoded_operand(d, 1) : -decoded_operand(d, 1);
+		wrap_sp(v);
+		return true;
+	}
+	else if (sp_reg >= 0 && is_mnemonic(d, "SUBI") && decoded_operand(d, 0) == sp_reg) {
+		v->sp_depth += decoded_operand(d, 1);
+		wrap_sp(v);
+		return true;
+	}
+	else if (sp_reg >= 0 && is_mnemonic(d, "SBCI") && decoded_operand(d, 0) == sp_reg + 1) {
+		v->sp_depth += decoded_operand(d, 1) << 8;
+		wrap_sp(v);
+		return true;
+	}
+	else if (sp_reg >= 0 && is_mnemonic(d, "SBC") && decoded_operand(d, 0) == sp_reg + 1 &&
+		 (v->zeros & REG(decoded_operand(d, 1)))) { // sbc r29, __zero_reg__: only the borrow of SUBI
+		return true;
+	}
+
+	if (sp_reg >= 0 && (def & REG_PAIR(sp_reg))) {
+		v->sp_reg = -1;
+	}
+
+	switch (instr->flow) {
+		case FLOW_CALL: {
+			int64_t target = branch_target(d);
+			if (target == d->addr + d->len) { // RCALL .+0 reserves stack space
+				v->depth += an->ret_bytes;
+			}
+			else {
+				add_call(f, d->addr, find_function(an, (uint32_t) target), v->depth);
+			}
+			break;
+		}
+		case FLOW_ICALL:
+			f->indirect = true;
+			if (report) printf("0x%04X: unresolved %s in 0x%04X\n", d->addr, instr->mnemonic, f->addr);
+			add_call(f, d->addr, an->nfuncs, v->depth);
+			break;
+		case FLOW_IJUMP:
+			f->indirect = true;
+			if (report) printf("0x%04X: unresolved %s in 0x%04X\n", d->addr, instr->mnemonic, f->addr);
+			return false;
+		case FLOW_RET:
+			return false;
+	}
+	return true;
+}
+
+static void walk_function(Analysis* an, size_t fi) {
+
+	Function*    f	   = &an->funcs[fi];
+	AVR_Program* prog  = &an->prog;
+	size_t	     stamp = fi + 1;
+	size_t	     succ[3];
+
+	an->nwork = 0;
+	Visit entry = { 0, 0, -1, 0, REG(1), REG(1) };
+	push_visit(an, find_start(prog, f->addr), &entry);
+
+	while (an->nwork > 0) {
+
+		Visit v = an->work[--an->nwork];
+		if (v.index >= prog->count) {
+			continue;
+		}
+		if (an->stamp[v.index] == stamp && an->depth[v.index] >= v.depth) {
+			continue;
+		}
+		if (v.depth >= DEPTH_LIMIT) {
+			f->unbounded = true;
+			continue;
+		}
+		bool seen = an->stamp[v.index] == stamp;
+		an->stamp[v.index] = stamp;
+		an->depth[v.index] = v.depth;
+
+		const AVR_Decoded* d = &prog->instrs[v.index];
+		if (d->index == INSTR_NONE) {
+			continue;
+		}
+		if (!step(an, f, d, &v, !seen)) {
+			continue;
+		}
+		if (v.depth > f->frame) {
+			f->frame = v.depth;
+		}
+
+		int flow = AVR_INSTRUCTION_SET[d->index].flow;
+		int n	 = 0;
+		if (flow != FLOW_JUMP && contiguous(prog, v.index)) {
+			succ[n++] = v.index + 1;
+			if (flow == FLOW_SKIP && contiguous(prog, v.index + 1)) {
+				succ[n++] = v.index + 2;
+			}
+		}
+		if (flow == FLOW_JUMP || flow == FLOW_BRANCH) {
+			succ[n++] = find_start(prog, branch_target(d));
+		}
+		for (int i = 0; i < n; i++) {
+			push_visit(an, succ[i], &v);
+		}
+	}
+}
+
+/* Worst case of fi including callees; path holds the active call chain
+   so a recursion can be printed as a cycle. */
+static int worst_case(Analysis* an, size_t fi, size_t* path, int len) {
+
+	Function* f = &an->funcs[fi];
+	if (f->state == STATE_DONE) {
+		return f->worst;
+	}
+
+	f->state    = STATE_ACTIVE;
+	path[len++] = fi;
+
+	int worst = f->frame;
+	for (int i = 0; i < f->ncalls; i++) {
+
+		CallSite* c    = &f->calls[i];
+		int	  below = 0;
+
+		if (c->callee < an->nfuncs && an->funcs[c->callee].state == STATE_ACTIVE) {
+			int from = len - 1;
+			while (path[from] != c->callee) from--;
+			printf("recursion:");
+			for (int j = from; j < len; j++) {
+				an->funcs[path[j]].recursive = true;
+				printf(" 0x%04X ->", an->funcs[path[j]].addr);
+			}
+			printf(" 0x%04X\n", an->funcs[c->callee].addr);
+		}
+		else if (c->callee < an->nfuncs) {
+			below = worst_case(an, c->callee, path, len);
+		}
+		if (c->depth + an->ret_bytes + below > worst) {
+			worst = c->depth + an->ret_bytes + below;
+		}
+	}
+
+	f->worst = worst;
+	f->state = STATE_DONE;
+	return worst;
+}
+
+int stack_report(char* path, int format) {
+
+	Analysis an;
+	AVR_Image img;
+
+	memset(&an, 0, sizeof an);
+	load_avr_instructions();
+	image_init(&img);
+	load_image(path, format, &img);
+	decode_image(&img, &an.prog);
+
+	uint32_t end = img.count ? img.segs[img.count - 1].addr + img.segs[img.count - 1].len : 0;
+	an.ret_bytes = end > 0x20000 ? 3 : 2;
+
+	uint32_t* vectors;
+	size_t	  nvectors = program_vectors(&an.prog, &vectors);
+	collect_functions(&an, vectors, nvectors);
+
+	an.depth = xcalloc(an.prog.count + 1, sizeof(int));
+	an.stamp = xcalloc(an.prog.count + 1, sizeof(size_t));
+	for (size_t i = 0; i < an.nfuncs; i++) {
+		walk_function(&an, i);
+	}
+
+	size_t* chain = xcalloc(an.nfuncs + 1, sizeof(size_t));
+	for (size_t i = 0; i < an.nfuncs; i++) {
+		worst_case(&an, i, chain, 0);
+	}
+
+	printf("\nfunction  frame  worst  calls\n");
+	for (size_t i = 0; i < an.nfuncs; i++) {
+		Function* f = &an.funcs[i];
+		printf("0x%04X  %6d %6d %6d%s%s%s%s\n", f->addr, f->frame, f->worst, f->ncalls,
+		       f->recursive  ? "  recursive"	  : "",
+		       f->indirect   ? "  indirect calls" : "",
+		       f->unknown_sp ? "  unknown SP write" : "",
+		       f->unbounded  ? "  unbounded"	  : "");
+	}
+
+	/* An interrupt pushes its return address on top of whatever the
+	   interrupted code has pushed; nesting is not assumed. */
+	int main_worst = 0;
+	int irq_worst  = 0;
+	printf("\nvector  entry   worst\n");
+	for (size_t v = 0; v < nvectors; v++) {
+		size_t fi = find_function(&an, vectors[v]);
+		int worst = fi < an.nfuncs ? an.funcs[fi].worst : 0;
+		if (v == 0) {
+			main_worst = worst;
+		}
+		else {
+			worst += an.ret_bytes;
+			if (worst > irq_worst) irq_worst = worst;
+		}
+		printf("%6zu  0x%04X %6d\n", v, vectors[v], worst);
+	}
+	printf("\nworst case: %d bytes (reset %d + interrupt %d)\n", main_worst + irq_worst, main_worst, irq_worst);
+
+	for (size_t i = 0; i < an.nfuncs; i++) {
+		free(an.funcs[i].calls);
+	}
+	free(an.funcs);
+	free(an.depth);
+	free(an.stamp);
+	free(an.work);
+	free(chain);
+	free(vectors);
+	free_program(&an.prog);
+	image_free(&img);
+	return EXIT_SUCCESS;
+}
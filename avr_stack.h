@@ -0,0 +1,3 @@
+#pragma once
+
+int stack_report(char* path, int format);
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include "avr_watch.h"
+#include "avr_incr.h"
+#include "avr_parse.h"
+#include "avr_instr.h"
+
+#ifdef __linux__
+#include <poll.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/wait.h>
+#include <sys/inotify.h>
+
+#define WATCH_DEBOUNCE 30 // ms without events before regenerating
+
+/* Runs in a child so a half-written or broken input, which the parser
+   exits on, does not end the watch. The child shares the loaded
+   instruction table. */
+static void regenerate(char* path, int format, char* output) {
+
+	pid_t pid = fork();
+	if (pid == 0) {
+
+		clock_t		 start = clock();
+		AVR_Image	 img;
+		IncrementalStats stats;
+
+		image_init(&img);
+		load_image(path, format, &img);
+		render_incremental(&img, output, &stats);
+		fprintf(stderr, "ihex2avr: %zu of %zu blocks rendered in %.1f ms\n", stats.rendered, stats.blocks,
+			(double) (clock() - start) * 1000 / CLOCKS_PER_SEC);
+		_exit(EXIT_SUCCESS);
+	}
+
+	int status = 0;
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+		fprintf(stderr, "ihex2avr: %s not updated\n", output);
+	}
+}
+
+/* Whether the buffered events name the input. */
+static bool names_input(const char* events, ssize_t len, const char* name) {
+
+	for (ssize_t i = 0; i < len;) {
+		const struct inotify_event* ev = (const struct inotify_event*) (events + i);
+		if (ev->len > 0 && strcmp(ev->name, name) == 0) {
+			return true;
+		}
+		i += sizeof(struct inotify_event) + ev->len;
+	}
+	return false;
+}
+
+int watch_listing(char* path, int format, char* output) {
+
+	if (is_stdin(path)) {
+		fprintf(stderr, "ihex2avr: --watch needs a file\n");
+		return EXIT_FAILURE;
+	}
+	if (format == FORMAT_AUTO) {
+		format = detect_format(path);
+	}
+
+	load_avr_instructions();
+	regenerate(path, format, output);
+
+	/* The directory is watched, since builds often replace the file
+	   instead of writing it in place. */
+	char* dir_copy	= strdup(path);
+	char* base_copy = strdup(path);
+	char* dir	= dirname(dir_copy);
+	char* base	= basename(base_copy);
+
+	int fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		fprintf(stderr, "ihex2avr: could not watch %s\n", dir);
+		return EXIT_FAILURE;
+	}
+
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	for (;;) {
+
+		ssize_t len = read(fd, events, sizeof events);
+		if (len <= 0) {
+			break;
+		}
+		if (!names_input(events, len, base)) {
+			continue;
+		}
+
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		while (poll(&pfd, 1, WATCH_DEBOUNCE) > 0) {
+			if (read(fd, events, sizeof events) <= 0) {
+				break;
+			}
+		}
+		regenerate(path, format, output);
+	}
+
+	close(fd);
+	free(dir_copy);
+	free(base_copy);
+	return EXIT_FAILURE;
+}
+
+#else
+
+int watch_listing(char* path, int format, char* output) {
+
+	(void) path;
+	(void) format;
+	(void) output;
+	fprintf(stderr, "ihex2avr: --watch needs inotify and is only available on Linux\n");
+	return EXIT_FAILURE;
+}
+
+#endif
@@ -0,0 +1,5 @@
+#pragma once
+
+/* Renders the incremental listing of path to output, then again every
+   time path is written or replaced, until interrupted. Linux only. */
+int watch_listing(char* path, int format, char* output);